@@ -90,7 +90,7 @@ namespace {
     filesystem::path makeWithString(const char* argv0) {
         filesystem::error_code ec;
         auto p(filesystem::canonical(argv0, ec));
-        return ec ? p.make_preferred() : filesystem::path{};
+        return ec ? filesystem::path{} : p.make_preferred();
     }
 
     auto makeWithString(const std::string& str) { return makeWithString(str.c_str()); }
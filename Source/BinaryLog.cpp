@@ -0,0 +1,208 @@
+//
+// Core: BinaryLog.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include "Core/BinaryLog.h"
+
+namespace BinaryLog {
+    namespace {
+        constexpr size_t bufferSize = 64 * 1024;
+
+        struct ThreadBuffer;
+
+        // Lock order: registry -> ThreadBuffer::lock -> file. The owning thread only takes its buffer's lock to
+        // hand the buffer off when it is full and at thread exit
+        struct State {
+            std::mutex registry, file;
+            std::ofstream stream;
+            std::vector<std::string> descriptors;
+            std::vector<ThreadBuffer*> buffers;
+            std::atomic_bool opened{false};
+            uint64_t threadCount = 0;
+        };
+
+        State& state() {
+            static State instance;
+            return instance;
+        }
+
+        template <class T>
+        void append(std::string& out, const T& val) { out.append(reinterpret_cast<const char*>(&val), sizeof(T)); }
+
+        void appendString(std::string& out, const char* str) {
+            const auto len = static_cast<uint16_t>(std::min<size_t>(std::strlen(str ? str : ""), UINT16_MAX));
+            append(out, len);
+            out.append(str ? str : "", len);
+        }
+
+        std::string describe(const Site& site, uint32_t id) {
+            std::string ret;
+            append(ret, Entry::site);
+            append(ret, id);
+            append(ret, static_cast<uint8_t>(site.level));
+            append(ret, static_cast<uint32_t>(site.line));
+            append(ret, site.argCount);
+            ret.append(reinterpret_cast<const char*>(site.types), site.argCount);
+            appendString(ret, site.file);
+            appendString(ret, site.func);
+            appendString(ret, site.component);
+            appendString(ret, site.format);
+            return ret;
+        }
+
+        struct ThreadBuffer {
+            ThreadBuffer() : data(bufferSize) {
+                auto& s = state();
+                std::lock_guard<std::mutex> lk(s.registry);
+                thread = ++s.threadCount;
+                s.buffers.push_back(this);
+            }
+
+            ~ThreadBuffer() {
+                auto& s = state();
+                std::lock_guard<std::mutex> lk(s.registry);
+                {
+                    std::lock_guard<std::mutex> own(lock);
+                    writeOut(used);
+                }
+                s.buffers.erase(std::find(s.buffers.begin(), s.buffers.end(), this));
+            }
+
+            // Caller holds `lock`. Writes the records in [flushed, end) as one chunk
+            void writeOut(size_t end) {
+                if (end == flushed)
+                    return;
+                auto& s = state();
+                std::lock_guard<std::mutex> lk(s.file);
+                if (s.stream.is_open()) {
+                    const auto length = static_cast<uint32_t>(end - flushed);
+                    s.stream.put(static_cast<char>(Entry::chunk));
+                    s.stream.write(reinterpret_cast<const char*>(&thread), sizeof(thread));
+                    s.stream.write(reinterpret_cast<const char*>(&length), sizeof(length));
+                    s.stream.write(data.data() + flushed, length);
+                }
+                flushed = end;
+            }
+
+            // Owning thread: writes out what flush() has not taken yet and starts over with room for `size`
+            void handoff(size_t size) {
+                std::lock_guard<std::mutex> own(lock);
+                writeOut(used);
+                used = flushed = 0;
+                committed.store(0, std::memory_order_relaxed);
+                if (size > data.size())
+                    data.resize(size);
+            }
+
+            std::mutex lock;
+            std::vector<char> data;
+            // `used` is only touched by the owning thread; flush() reads the complete records up to `committed`
+            size_t used = 0;
+            std::atomic<size_t> committed{0};
+            // Under `lock`: the records before it are in the file
+            size_t flushed = 0;
+            uint64_t thread = 0;
+        };
+
+        ThreadBuffer& threadBuffer() {
+            thread_local ThreadBuffer buffer;
+            return buffer;
+        }
+    }
+
+    bool open(const std::string& path) {
+        close();
+        auto& s = state();
+        std::lock_guard<std::mutex> lk(s.registry);
+        std::lock_guard<std::mutex> file(s.file);
+        s.stream.open(path, std::ios::binary | std::ios::trunc);
+        if (!s.stream.is_open())
+            return false;
+        s.stream.write(magic, sizeof(magic));
+        s.stream.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        for (auto& x : s.descriptors)
+            s.stream.write(x.data(), x.size());
+        s.opened.store(true);
+        return true;
+    }
+
+    void close() {
+        auto& s = state();
+        if (!s.opened.exchange(false))
+            return;
+        flush();
+        std::lock_guard<std::mutex> file(s.file);
+        s.stream.close();
+    }
+
+    void flush() {
+        auto& s = state();
+        std::lock_guard<std::mutex> lk(s.registry);
+        for (auto x : s.buffers) {
+            std::lock_guard<std::mutex> own(x->lock);
+            x->writeOut(x->committed.load(std::memory_order_acquire));
+        }
+        std::lock_guard<std::mutex> file(s.file);
+        s.stream.flush();
+    }
+
+    uint32_t registerSite(Site& site, const char* format, const ArgType* types, uint8_t argCount) {
+        auto& s = state();
+        std::lock_guard<std::mutex> lk(s.registry);
+        if (const auto id = site.id.load(); id)
+            return id;
+        site.format = format;
+        site.types = types;
+        site.argCount = argCount;
+        const auto id = static_cast<uint32_t>(s.descriptors.size() + 1);
+        // Keep a copy of the descriptor: the site may live in a module that is unloaded before the next `open`
+        s.descriptors.push_back(describe(site, id));
+        {
+            std::lock_guard<std::mutex> file(s.file);
+            if (s.stream.is_open())
+                s.stream.write(s.descriptors.back().data(), s.descriptors.back().size());
+        }
+        site.id.store(id, std::memory_order_release);
+        return id;
+    }
+
+    char* reserve(size_t size) {
+        if (!state().opened.load(std::memory_order_relaxed))
+            return nullptr;
+        auto& buffer = threadBuffer();
+        if (buffer.used + size > buffer.data.size())
+            buffer.handoff(size);
+        return buffer.data.data() + buffer.used;
+    }
+
+    void commit(size_t size) noexcept {
+        auto& buffer = threadBuffer();
+        buffer.used += size;
+        buffer.committed.store(buffer.used, std::memory_order_release);
+    }
+
+    uint64_t timestamp() noexcept {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+}
@@ -21,12 +21,30 @@
 
 #if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
 
+#include <io.h>
 #include "Windows.hpp"
 
 namespace LColorFunc {
     // Microsoft Windows
     static HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
 
+    bool isTerminal(std::FILE* stream) noexcept { return _isatty(_fileno(stream)); }
+
+    bool supportsAnsi(std::FILE* stream) noexcept {
+        if (!isTerminal(stream))
+            return false;
+        const auto handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(stream)));
+        DWORD mode = 0;
+        if (!GetConsoleMode(handle, &mode))
+            return false;
+#ifdef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+        return (mode & ENABLE_VIRTUAL_TERMINAL_PROCESSING) ||
+               SetConsoleMode(handle, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#else
+        return false;
+#endif
+    }
+
     std::ostream& black(std::ostream& s) noexcept {
         SetConsoleTextAttribute(hStdout, 0);
         return s;
@@ -110,7 +128,18 @@ namespace LColorFunc {
 
 #else
     // *nix
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
 namespace LColorFunc {
+    bool isTerminal(std::FILE* stream) noexcept { return isatty(fileno(stream)); }
+
+    bool supportsAnsi(std::FILE* stream) noexcept {
+        const auto term = std::getenv("TERM");
+        return isTerminal(stream) && !(term && !std::strcmp(term, "dumb"));
+    }
+
     std::ostream& black(std::ostream &s) noexcept { return s << "\033[21;30m"; }
 
     std::ostream& lblack(std::ostream &s) noexcept { return s << "\033[1;30m"; }
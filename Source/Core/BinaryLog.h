@@ -0,0 +1,205 @@
+//
+// Core: BinaryLog.h
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "Config.h"
+#include "Logger.h"
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+/*
+ * Deferred-format logging. A call site is described once by a static `Site`; each call then only copies the raw
+ * argument bytes into a per-thread buffer, and the text is produced offline by the LogDecoder tool.
+ *
+ * File layout (native byte order):
+ *   header : "NWBL" u32 version
+ *   site   : u8 Entry::site, u32 id, u8 level, u32 line, u8 argc, u8 types[argc],
+ *            then file, function, component and format, each as u16 length + bytes
+ *   chunk  : u8 Entry::chunk, u64 thread, u32 length, then `length` bytes of records
+ *   record : u32 site id, u64 nanoseconds since epoch, arguments
+ * Strings are stored as u32 length + bytes, every other argument with the width of its ArgType.
+ */
+namespace BinaryLog {
+    constexpr char magic[4] = {'N', 'W', 'B', 'L'};
+    constexpr uint32_t version = 1;
+
+    enum class Entry : uint8_t { site = 1, chunk = 2 };
+
+    enum class ArgType : uint8_t { boolean, character, i32, u32, i64, u64, f64, string, pointer };
+
+    struct Site {
+        constexpr Site(const char* file, const char* func, int line, Logger::Level level, const char* component) noexcept
+                : file(file), func(func), line(line), level(level), component(component) {}
+        const char* file;
+        const char* func;
+        int line;
+        Logger::Level level;
+        const char* component;
+        const char* format = nullptr;
+        const ArgType* types = nullptr;
+        uint8_t argCount = 0;
+        std::atomic<uint32_t> id{0};
+    };
+
+    /**
+     * \brief Start writing binary records to a file. Every site registered so far is written to it first
+     * \param path The file to create
+     * \return false if the file could not be opened
+     */
+    NWCOREAPI bool open(const std::string& path);
+
+    /**
+     * \brief Flush every thread's buffer and close the binary log
+     */
+    NWCOREAPI void close();
+
+    /**
+     * \brief Move the records buffered by all threads to the file
+     */
+    NWCOREAPI void flush();
+
+    // Assigns an id to the site and writes its descriptor; only the first call for a site does any work
+    NWCOREAPI uint32_t registerSite(Site& site, const char* format, const ArgType* types, uint8_t argCount);
+
+    // Returns room for `size` bytes in the calling thread's buffer, or nullptr if no binary log is open.
+    // Every successful reserve must be followed by a commit of the same size
+    NWCOREAPI char* reserve(size_t size);
+
+    NWCOREAPI void commit(size_t size) noexcept;
+
+    NWCOREAPI uint64_t timestamp() noexcept;
+
+    namespace Details {
+        template <class T>
+        constexpr ArgType typeOf() noexcept {
+            using U = std::decay_t<T>;
+            if constexpr (std::is_same_v<U, bool>)
+                return ArgType::boolean;
+            else if constexpr (std::is_same_v<U, char>)
+                return ArgType::character;
+            else if constexpr (std::is_enum_v<U>)
+                return typeOf<std::underlying_type_t<U>>();
+            else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>)
+                return sizeof(U) <= 4 ? ArgType::i32 : ArgType::i64;
+            else if constexpr (std::is_integral_v<U>)
+                return sizeof(U) <= 4 ? ArgType::u32 : ArgType::u64;
+            else if constexpr (std::is_floating_point_v<U>)
+                return ArgType::f64;
+            else if constexpr (std::is_same_v<U, const char*> || std::is_same_v<U, char*> ||
+                               std::is_same_v<U, std::string> || std::is_same_v<U, std::string_view>)
+                return ArgType::string;
+            else if constexpr (std::is_pointer_v<U>)
+                return ArgType::pointer;
+            else
+                static_assert(std::is_void_v<U>, "Type cannot be written to the binary log");
+        }
+
+        template <class... Args>
+        constexpr ArgType argTypes[sizeof...(Args) + 1] = {typeOf<Args>()..., ArgType::boolean};
+
+        inline std::string_view view(const char* str) noexcept { return str ? str : ""; }
+
+        inline std::string_view view(const std::string& str) noexcept { return str; }
+
+        inline std::string_view view(std::string_view str) noexcept { return str; }
+
+        template <class T>
+        size_t sizeOf(const T& arg) noexcept {
+            constexpr auto type = typeOf<T>();
+            if constexpr (type == ArgType::string)
+                return sizeof(uint32_t) + view(arg).size();
+            else if constexpr (type == ArgType::boolean || type == ArgType::character)
+                return 1;
+            else if constexpr (type == ArgType::i32 || type == ArgType::u32)
+                return 4;
+            else
+                return 8;
+        }
+
+        template <class T>
+        char* put(char* out, const T& val) noexcept {
+            std::memcpy(out, &val, sizeof(T));
+            return out + sizeof(T);
+        }
+
+        template <class T>
+        char* encode(char* out, const T& arg) noexcept {
+            constexpr auto type = typeOf<T>();
+            if constexpr (type == ArgType::string) {
+                const auto str = view(arg);
+                out = put(out, static_cast<uint32_t>(str.size()));
+                std::memcpy(out, str.data(), str.size());
+                return out + str.size();
+            }
+            else if constexpr (type == ArgType::pointer)
+                return put(out, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(arg)));
+            else if constexpr (type == ArgType::f64)
+                return put(out, static_cast<double>(arg));
+            else if constexpr (type == ArgType::boolean || type == ArgType::character)
+                return put(out, static_cast<uint8_t>(arg));
+            else if constexpr (type == ArgType::i32)
+                return put(out, static_cast<int32_t>(arg));
+            else if constexpr (type == ArgType::u32)
+                return put(out, static_cast<uint32_t>(arg));
+            else if constexpr (type == ArgType::i64)
+                return put(out, static_cast<int64_t>(arg));
+            else
+                return put(out, static_cast<uint64_t>(arg));
+        }
+    }
+
+    template <class... Args>
+    void write(Site& site, const char* format, const Args&... args) {
+        static_assert(sizeof...(Args) < 256, "Too many arguments for a binary log record");
+        auto id = site.id.load(std::memory_order_acquire);
+        if (!id)
+            id = registerSite(site, format, Details::argTypes<Args...>, static_cast<uint8_t>(sizeof...(Args)));
+        const size_t size = sizeof(uint32_t) + sizeof(uint64_t) + (size_t(0) + ... + Details::sizeOf(args));
+        if (auto out = reserve(size); out) {
+            out = Details::put(out, id);
+            out = Details::put(out, timestamp());
+            ((out = Details::encode(out, args)), ...);
+            commit(size);
+        }
+    }
+}
+
+// Subject to the same compile-time and runtime level gates as `loggerstream`
+#define loggerbinary(level, ...) \
+    do { \
+        if constexpr (static_cast<int>(Logger::Level::level) >= NW_MIN_LOG_LEVEL) { \
+            if (Logger::enabled(Logger::Level::level, nwLogComponent)) { \
+                static BinaryLog::Site NWBinarySite(__FILE__, __FUNCTION__, __LINE__, Logger::Level::level, \
+                                                    NW_COMPONENT_NAME); \
+                BinaryLog::write(NWBinarySite, __VA_ARGS__); \
+            } \
+        } \
+    } while (false)
+// Binary counterparts of the stream macros. Usage: `verbosebinary("chunk {} loaded in {}ms", id, ms);`
+#define verbosebinary(...) loggerbinary(verbose, __VA_ARGS__)
+#define debugbinary(...) loggerbinary(debug, __VA_ARGS__)
+#define infobinary(...) loggerbinary(info, __VA_ARGS__)
+#define warningbinary(...) loggerbinary(warning, __VA_ARGS__)
+#define errorbinary(...) loggerbinary(error, __VA_ARGS__)
+#define fatalbinary(...) loggerbinary(fatal, __VA_ARGS__)
@@ -66,6 +66,6 @@
 #define JOIN( symbol1, symbol2 ) _DO_JOIN( symbol1, symbol2 )
 #define LINE_NAME( prefix ) JOIN( prefix, __LINE__ )
 
-#define BGEIN_STATIC_INIT_RUN() namespace { struct LINE_NAME(NWSIR) { LINE_NAME(NWSAR) noexcept () {
+#define BGEIN_STATIC_INIT_RUN() namespace { struct LINE_NAME(NWSIR) { LINE_NAME(NWSIR) () noexcept {
 
 #define END_STATIC_INIT_RUN }} LINE_NAME(NWSARE); }
\ No newline at end of file
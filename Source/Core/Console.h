@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <cstdio>
 #include <ostream>
 #include "Config.h"
 
@@ -56,6 +57,19 @@ namespace LColorFunc {
     NWCOREAPI std::ostream& white(std::ostream& s) noexcept;
 
     NWCOREAPI std::ostream& lwhite(std::ostream& s) noexcept;
+
+    // Color functions in the order of their codes (`&0` ... `&f`)
+    constexpr ColorFunc byCode[16] = {
+        black, red, yellow, green, cyan, blue, magenta, white,
+        lblack, lred, lyellow, lgreen, lcyan, lblue, lmagenta, lwhite
+    };
+
+    // Whether `stream` is an interactive console
+    NWCOREAPI bool isTerminal(std::FILE* stream) noexcept;
+
+    // Whether `stream` is a console that interprets ANSI color sequences. On Windows this switches
+    // the console to virtual terminal mode when it is available
+    NWCOREAPI bool supportsAnsi(std::FILE* stream) noexcept;
 }
 
 namespace LColor {
@@ -75,4 +89,23 @@ namespace LColor {
     constexpr const char* lblue = "&d";
     constexpr const char* lmagenta = "&e";
     constexpr const char* lwhite = "&f";
+
+    // ANSI sequences in the order of the codes above
+    constexpr const char* ansi[16] = {
+        "\033[21;30m", "\033[21;31m", "\033[21;33m", "\033[21;32m",
+        "\033[21;36m", "\033[21;34m", "\033[21;35m", "\033[21;37m",
+        "\033[1;30m", "\033[1;31m", "\033[1;33m", "\033[1;32m",
+        "\033[1;36m", "\033[1;34m", "\033[1;35m", "\033[1;37m"
+    };
+
+    // Position of a code character in `ansi`, or -1 if it is not a color code
+    constexpr int codeIndex(char ch) noexcept {
+        if (ch >= '0' && ch <= '9')
+            return ch - '0';
+        if (ch >= 'a' && ch <= 'f')
+            return ch - 'a' + 10;
+        if (ch >= 'A' && ch <= 'F')
+            return ch - 'A' + 10;
+        return -1;
+    }
 }
@@ -1,11 +1,37 @@
 #pragma once
 #include <mutex>
+#include <atomic>
+#include <memory>
 #include <vector>
+#include <new>
+#include <algorithm>
+#include <tuple>
+#include <future>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <exception>
 #include <type_traits>
+#include "Config.h"
+#include "Span.h"
+#include "Intrusive.h"
+#include "Mailbox.h"
+#include "TypeId.h"
+#include "WorkerPool.h"
 
+/*
+ * A Reduce policy is called as `reduce(out, result)` for each closure in turn, with `out` starting as the value of
+ * `Reduce::Initial()` if it has one, else value-initialized. If the call returns bool, false means the result is
+ * known and the closures left are skipped.
+ * A Reduce policy declares `static constexpr bool Associative = true` to allow parallel emission, which reduces
+ * contiguous ranges of closures on their own and then feeds the result of each range that ran, in order, into
+ * `reduce(out, result)` as if it were a single closure returning it.
+ */
 template <class T>
 struct LastValue {
     using TargetType = T;
+    // The last value of the last range is the last value
+    static constexpr bool Associative = true;
 
     void operator()(T& out, const T& last) noexcept { out = last; }
 };
@@ -20,88 +46,688 @@ struct Ignore {
     using TargetType = void;
 };
 
+// The first result that converts to true, or a value-initialized one; T is usually a pointer or an optional
+template <class T>
+struct FirstNonNull {
+    using TargetType = T;
+    static constexpr bool Associative = true;
+
+    bool operator()(T& out, const T& value) {
+        if (!value)
+            return true;
+        out = value;
+        return false;
+    }
+};
+
+// Whether any closure returned true, false if there are none
+template <class T>
+struct AnyTrue {
+    using TargetType = bool;
+    static constexpr bool Associative = true;
+
+    bool operator()(bool& out, const T& value) noexcept { return !(out = static_cast<bool>(value)); }
+};
+
+// Whether all closures returned true, true if there are none
+template <class T>
+struct AllTrue {
+    using TargetType = bool;
+    static constexpr bool Associative = true;
+
+    static constexpr bool Initial() noexcept { return true; }
+
+    bool operator()(bool& out, const T& value) noexcept { return out = static_cast<bool>(value); }
+};
+
+// For cancellable events: a closure returns true to veto, and the result is whether nobody did.
+// Not associative, as the result of a range reads the other way round than the result of a closure
+template <class T>
+struct Veto {
+    using TargetType = bool;
+
+    static constexpr bool Initial() noexcept { return true; }
+
+    bool operator()(bool& out, const T& vetoed) noexcept { return out = !static_cast<bool>(vetoed); }
+};
+
 namespace __Details {
+    template <class R, class = void>
+    struct IsAssociative : std::false_type {};
+
+    template <class R>
+    struct IsAssociative<R, std::void_t<decltype(R::Associative)>> : std::bool_constant<R::Associative> {};
+
+    template <class R, class = void>
+    struct HasInitial : std::false_type {};
+
+    template <class R>
+    struct HasInitial<R, std::void_t<decltype(R::Initial())>> : std::true_type {};
+
+    // The value a reduction starts from; a placeholder if the result is ignored
+    template <class R>
+    auto ReduceInitial() {
+        using Result = typename R::TargetType;
+        if constexpr (std::is_void_v<Result>)
+            return char();
+        else if constexpr (HasInitial<R>::value)
+            return Result(R::Initial());
+        else
+            return Result{};
+    }
+
+    // Reduces one more value into `out`, returns false once the result is known
+    template <class R, class Out, class V>
+    bool ReduceFeed(R& reduce, Out& out, V&& value) {
+        if constexpr (std::is_same_v<decltype(reduce(out, std::forward<V>(value))), bool>)
+            return reduce(out, std::forward<V>(value));
+        else
+            return reduce(out, std::forward<V>(value)), true;
+    }
+
     struct DelegateHelpers {
     protected:
+        // A closure that does not fit into its slot, or other state a connection keeps
         struct A {
             virtual ~A() noexcept = default;
-            std::shared_ptr<A> _Retain = nullptr;
+            // True once the closure can never run again, compaction then disconnects it
+            virtual bool Expired() const noexcept { return false; }
+            // Cleared by Disconnect, for calls that were posted before
+            std::atomic_bool _Live {true};
+        };
+
+        // Set by a weakly bound closure that found its object gone, during the emission that called it
+        static inline thread_local bool _SawExpired = false;
+
+        // What emission reads per subscriber: a thunk that knows the closure type, and the closure itself if it
+        // is small and trivially copyable (plain functions, member function bindings, most lambdas), else a
+        // pointer to it. Slots are stored by value in the snapshot, so dispatch walks one contiguous array
+        struct Slot {
+            void (*Invoke)() = nullptr; // The real signature is only known to the delegate that stored it
+            std::aligned_storage_t<4 * sizeof(void*), alignof(void*)> Data;
+        };
+
+        template <class Func>
+        static constexpr bool IsInline = sizeof(Func) <= sizeof(Slot::Data) && alignof(Func) <= alignof(void*) &&
+                                         std::is_trivially_copyable_v<Func> && std::is_trivially_destructible_v<Func>;
+
+        template <class Func>
+        struct Heap : A {
+            explicit Heap(Func&& fn) : _Fc(std::move(fn)) {}
+            Func _Fc;
+        };
+
+        // A closure that runs on the thread owning `_Target`: called directly there, posted to it from elsewhere.
+        // Expires with the mailbox, after which calls are dropped and the connection goes at the next compaction
+        template <class Func>
+        struct Affine : A {
+            Affine(const Mailbox& target, Func&& fn) : _Target(target.queue()), _Fc(std::move(fn)) {}
+            bool Expired() const noexcept override { return _Target.expired(); }
+            std::weak_ptr<Mailbox::Queue> _Target;
+            Func _Fc;
+            std::weak_ptr<A> _Self;
+        };
+
+        // A member function bound to an object by a weak reference; the binding is stored in the slot as raw
+        // pointers, and the registry entry holds the weak reference that keeps the control block valid for them
+        template <class C, class Method>
+        struct WeakBinding {
+            IntrusiveVTBase* Ctrl;
+            C* Object;
+            Method Fn;
+        };
+
+        // Holds the binding and the weak reference when the binding does not fit into the slot
+        template <class C, class Binding>
+        struct WeakOwner : A {
+            explicit WeakOwner(const WeakIntrusivePtr<C>& object, Binding binding) : _Ref(object), _Binding(binding) {}
+            bool Expired() const noexcept override { return _Ref.Expired(); }
+            WeakIntrusivePtr<C> _Ref;
+            Binding _Binding;
+        };
+
+        template <class R, class... Args>
+        struct Target {
+            using Invoke = R (*)(const Slot&, Args&&...);
+
+            template <class Func>
+            static R CallInline(const Slot& slot, Args&&... arg) {
+                return (*std::launder(reinterpret_cast<const Func*>(&slot.Data)))(std::forward<Args>(arg)...);
+            }
+
+            template <class Func>
+            static R CallHeap(const Slot& slot, Args&&... arg) {
+                const void* fn;
+                std::memcpy(&fn, &slot.Data, sizeof(fn));
+                return (*static_cast<const Func*>(fn))(std::forward<Args>(arg)...);
+            }
+
+            // The first `Skip` arguments are not passed on: those are the ones only valid during the emission
+            template <class Func, size_t Skip>
+            static void CallAffine(const Slot& slot, Args&&... arg) {
+                const void* ptr;
+                std::memcpy(&ptr, &slot.Data, sizeof(ptr));
+                const auto fn = static_cast<const Affine<Func>*>(ptr);
+                if (const auto target = fn->_Target.lock(); target)
+                    PostAffine<Skip>(fn, *target, std::forward_as_tuple(std::forward<Args>(arg)...),
+                                     std::make_index_sequence<sizeof...(Args) - Skip>());
+                else
+                    _SawExpired = true;
+            }
+
+            template <size_t Skip, class Func, class Tuple, size_t... I>
+            static void PostAffine(const Affine<Func>* fn, Mailbox::Queue& target, Tuple&& arg,
+                                   std::index_sequence<I...>) {
+                using Passed = std::tuple<Args...>;
+                if (target.isOwner())
+                    return fn->_Fc(std::get<Skip + I>(std::move(arg))...);
+                auto self = std::static_pointer_cast<const Affine<Func>>(fn->_Self.lock());
+                if (!self)
+                    return;
+                target.post([self = std::move(self), args = std::tuple<std::decay_t<std::tuple_element_t<
+                        Skip + I, Passed>>...>(std::get<Skip + I>(std::move(arg))...)]() mutable {
+                    // Disconnected while the call was queued
+                    if (self->_Live.load(std::memory_order_acquire))
+                        self->_Fc(std::forward<std::tuple_element_t<Skip + I, Passed>>(std::get<I>(args))...);
+                });
+            }
+
+            // Arguments are copied into a posted call, unless they are references to non-const
+            template <size_t Skip, size_t... I>
+            static constexpr bool IsPostable(std::index_sequence<I...>) noexcept {
+                using Passed = std::tuple<Args...>;
+                return (... && !(std::is_lvalue_reference_v<std::tuple_element_t<Skip + I, Passed>> &&
+                                 !std::is_const_v<std::remove_reference_t<std::tuple_element_t<Skip + I, Passed>>>));
+            }
+
+            template <class C, class Binding>
+            static R CallWeak(const Slot& slot, Args&&... arg) {
+                const Binding* binding;
+                if constexpr (IsInline<Binding>)
+                    binding = std::launder(reinterpret_cast<const Binding*>(&slot.Data));
+                else {
+                    const void* ptr;
+                    std::memcpy(&ptr, &slot.Data, sizeof(ptr));
+                    binding = &static_cast<const WeakOwner<C, Binding>*>(ptr)->_Binding;
+                }
+                if (const auto object = IntrusivePtr<C>::Lock(binding->Ctrl, binding->Object); object)
+                    return (binding->Object->*binding->Fn)(std::forward<Args>(arg)...);
+                _SawExpired = true;
+                if constexpr (!std::is_void_v<R>)
+                    return R{};
+            }
+
+            static R Call(const Slot& slot, Args&&... arg) {
+                return reinterpret_cast<Invoke>(slot.Invoke)(slot, std::forward<Args>(arg)...);
+            }
+
+            // Returns the slot, and the owner of the closure if it does not fit into the slot
+            template <class Func>
+            static std::pair<std::shared_ptr<A>, Slot> Make(Func&& fn) {
+                Slot slot;
+                if constexpr (IsInline<Func>) {
+                    new(&slot.Data) Func(std::move(fn));
+                    slot.Invoke = reinterpret_cast<void (*)()>(&CallInline<Func>);
+                    return {nullptr, slot};
+                }
+                else {
+                    auto heap = std::make_shared<Heap<Func>>(std::move(fn));
+                    const void* ptr = &heap->_Fc;
+                    std::memcpy(&slot.Data, &ptr, sizeof(ptr));
+                    slot.Invoke = reinterpret_cast<void (*)()>(&CallHeap<Func>);
+                    return {std::move(heap), slot};
+                }
+            }
+
+            // Returns the weak reference itself along with an inline binding, which the registry entry keeps
+            template <class C, class Method>
+            static auto MakeWeak(const WeakIntrusivePtr<C>& object, Method method) {
+                using Binding = WeakBinding<C, Method>;
+                const Binding binding {object.Control(), object.Pointer(), method};
+                Slot slot;
+                slot.Invoke = reinterpret_cast<void (*)()>(&CallWeak<C, Binding>);
+                if constexpr (IsInline<Binding>) {
+                    new(&slot.Data) Binding(binding);
+                    return std::pair(WeakIntrusivePtr<IntrusiveVTBase>::Reference(binding.Ctrl, binding.Ctrl), slot);
+                }
+                else {
+                    auto owner = std::make_shared<WeakOwner<C, Binding>>(object, binding);
+                    const void* ptr = owner.get();
+                    std::memcpy(&slot.Data, &ptr, sizeof(ptr));
+                    return std::pair<std::shared_ptr<A>, Slot>(std::move(owner), slot);
+                }
+            }
+
+            template <size_t Skip = 0, class Func>
+            static std::pair<std::shared_ptr<A>, Slot> MakeAffine(const Mailbox& target, Func&& fn) {
+                static_assert(std::is_void_v<R>, "Only closures without a result can be posted to another thread");
+                static_assert(IsPostable<Skip>(std::make_index_sequence<sizeof...(Args) - Skip>()),
+                              "A posted call cannot take a reference to non-const, it would outlive the argument");
+                auto affine = std::make_shared<Affine<Func>>(target, std::move(fn));
+                affine->_Self = affine;
+                Slot slot;
+                const void* ptr = affine.get();
+                std::memcpy(&slot.Data, &ptr, sizeof(ptr));
+                slot.Invoke = reinterpret_cast<void (*)()>(&CallAffine<Func, Skip>);
+                return {std::move(affine), slot};
+            }
+        };
+
+        /*
+         * A slot map of the connections of one delegate, shared with their handles and kept until the last of them
+         * is gone. An entry is taken per connection and reused after it was disconnected; its generation changes on
+         * every disconnection, so a handle to an earlier use of the entry reads as disconnected. Entries are
+         * allocated in blocks that never move, which lets snapshots and handles point at them directly.
+         */
+        class Registry : public IntrusiveVTBase {
+        public:
+            struct Entry {
+                std::atomic<uint32_t> Generation {0};
+                // Guarded by _Lock: the closure of the current use if it is not inline, or the next free entry
+                std::shared_ptr<A> Owner;
+                Entry* NextFree = nullptr;
+                // Guarded by _Lock: whether Object is set, which keeps a disconnected entry off the free list
+                bool Held = false;
+                // The object of an inline weak binding. Set before the closure is published, and only moved out
+                // by the compaction that drops it, into the snapshot emissions may still be calling it from
+                WeakIntrusivePtr<IntrusiveVTBase> Object;
+            };
+
+            // Takes an entry for a new connection and returns its generation
+            std::pair<Entry*, uint32_t> Allocate(std::shared_ptr<A> owner, WeakIntrusivePtr<IntrusiveVTBase> object) {
+                std::lock_guard<std::mutex> lk(_Lock);
+                if (!_Free) {
+                    _Blocks.push_back(std::make_unique<Entry[]>(BlockSize));
+                    for (auto i = BlockSize; i-- > 0;) {
+                        _Blocks.back()[i].NextFree = _Free;
+                        _Free = &_Blocks.back()[i];
+                    }
+                }
+                const auto entry = _Free;
+                _Free = entry->NextFree;
+                entry->Owner = std::move(owner);
+                entry->Held = static_cast<bool>(object.Control());
+                entry->Object = std::move(object);
+                return {entry, entry->Generation.load(std::memory_order_relaxed)};
+            }
+
+            bool Connected(const Entry* entry, uint32_t generation) const noexcept {
+                return !_Closed.load(std::memory_order_acquire) &&
+                       entry->Generation.load(std::memory_order_acquire) == generation;
+            }
+
+            void Release(Entry* entry, uint32_t generation) noexcept {
+                std::shared_ptr<A> owner;
+                {
+                    std::lock_guard<std::mutex> lk(_Lock);
+                    if (entry->Generation.load(std::memory_order_relaxed) != generation)
+                        return;
+                    entry->Generation.store(generation + 1, std::memory_order_release);
+                    owner = std::move(entry->Owner);
+                    if (!entry->Held) {
+                        entry->NextFree = _Free;
+                        _Free = entry;
+                    }
+                }
+                if (owner)
+                    owner->_Live.store(false, std::memory_order_release);
+                Disconnects.fetch_add(1, std::memory_order_release);
+                // The snapshots still hold the closure, it goes with the last of them
+            }
+
+            // Returns a disconnected entry whose object was handed over to a snapshot to the free list
+            void Recycle(Entry* entry) noexcept {
+                std::lock_guard<std::mutex> lk(_Lock);
+                entry->Held = false;
+                entry->NextFree = _Free;
+                _Free = entry;
+            }
+
+            // The delegate is gone, its handles read as disconnected from now on and the objects are let go
+            void Close() noexcept {
+                _Closed.store(true, std::memory_order_release);
+                std::lock_guard<std::mutex> lk(_Lock);
+                for (auto& block : _Blocks)
+                    for (size_t i = 0; i < BlockSize; ++i)
+                        block[i].Object = {};
+            }
+
+            // Bumped by every disconnection, so that emission only checks generations when there were some
+            std::atomic<uint64_t> Disconnects {0};
+        private:
+            static constexpr size_t BlockSize = 32;
+
+            std::atomic_bool _Closed {false};
+            std::mutex _Lock;
+            std::vector<std::unique_ptr<Entry[]>> _Blocks;
+            Entry* _Free = nullptr;
         };
     public:
         class Connection {
         public:
             constexpr Connection() noexcept = default;
 
-            bool Connected() const noexcept { return !_H.expired(); }
+            bool Connected() const noexcept { return _Registry && _Registry->Connected(_Entry, _Generation); }
 
-            void Disconnect() noexcept { if (auto p = _H.lock(); p) p->_Retain.reset(); }
+            void Disconnect() noexcept {
+                if (_Registry)
+                    _Registry->Release(_Entry, _Generation);
+            }
         private:
             template <class Mutex>
             friend class DelegateBase;
-            explicit Connection(std::shared_ptr<A> ptr) noexcept
-                    :_H(ptr) { ptr->_Retain = std::move(ptr); }
-            std::weak_ptr<A> _H;
+
+            Connection(IntrusivePtr<Registry> registry, Registry::Entry* entry, uint32_t generation) noexcept
+                    :_Registry(std::move(registry)), _Entry(entry), _Generation(generation) {}
+
+            IntrusivePtr<Registry> _Registry;
+            Registry::Entry* _Entry = nullptr;
+            uint32_t _Generation = 0;
         };
     };
 
+    /*
+     * Emission reads an immutable snapshot of the subscribers, published with one atomic store by Connect and by
+     * compaction, so it takes no lock, allocates nothing and touches no reference count per subscriber.
+     * A replaced snapshot is retired rather than freed: readers announce themselves on one of two counters chosen
+     * by the current epoch, and a retired snapshot is freed once each counter has been seen at zero after its
+     * retirement, as every reader that could have loaded it was counted on one of them. Maintenance flips the epoch
+     * while snapshots wait, so that new readers pile up on the other counter and the waited-for one drains.
+     * Disconnected closures stay in the snapshot until an emission that saw them gets the lock with try_lock and
+     * publishes a compacted snapshot. Until then emissions compare the generation each closure was connected with
+     * to its registry entry; while nothing has been disconnected since the snapshot was built they only read the
+     * slots.
+     */
     template <class Mutex = std::mutex>
     class DelegateBase: public DelegateHelpers {
     protected:
-        DelegateBase() = default;
+        DelegateBase() : _Registry(MakeIntrusive<Registry>()) {}
 
-        template <class T>
-        auto Add(std::shared_ptr<T> closure) {
-            {
-                std::lock_guard<Mutex> lk(_Lock);
-                _List.emplace_back(closure);
-                ++_Count;
-            }
-            return Connection(std::move(closure));
+        DelegateBase(const DelegateBase&) = delete;
+
+        DelegateBase& operator=(const DelegateBase&) = delete;
+
+        ~DelegateBase() noexcept {
+            _Registry->Close();
+            Free(_Current.load(std::memory_order_relaxed));
+            Free(_RetiredList);
         }
 
-        auto ListValidsAndCompress() const {
-            std::lock_guard<Mutex> lk(_Lock);
-            std::vector<std::shared_ptr<void>> ret {};
-            ret.reserve(_Count);
-            if (_Count < (_List.size() * 3 / 4)) {
-                auto iter = _List.begin();
-                auto write = iter;
-                for(; iter != _List.end(); ++iter)
-                    if (auto v = iter->lock(); v) {
-                        ret.push_back(std::move(v));
-                        if (iter != write)
-                            *write = std::move(*iter);
-                        ++write;
-                    }
-                if (iter != write)
-                    _List.erase(write, iter);
+        // Closures run by descending priority, and in the order they were connected within one
+        auto Add(std::pair<std::shared_ptr<A>, Slot> closure, int priority) {
+            return Insert(std::move(closure.first), {}, closure.second, priority);
+        }
+
+        // An inline binding to an object by a weak reference, see Target::MakeWeak
+        auto Add(std::pair<WeakIntrusivePtr<IntrusiveVTBase>, Slot> closure, int priority) {
+            return Insert(nullptr, std::move(closure.first), closure.second, priority);
+        }
+
+        // Calls `fn(const Slot&)` for every connected closure, until it returns false if it returns bool
+        template <class Fn>
+        void ForEach(Fn&& fn) const {
+            const auto visit = [&fn](const Slot& x) {
+                if constexpr (std::is_same_v<decltype(fn(x)), bool>)
+                    return fn(x);
+                else
+                    return fn(x), true;
+            };
+            const auto outer = std::exchange(_SawExpired, false);
+            ReadGuard guard(*this);
+            if (const auto snapshot = _Current.load(std::memory_order_acquire); !snapshot) {}
+            else if (_Registry->Disconnects.load(std::memory_order_acquire) == snapshot->Disconnects) {
+                for (const auto& x : snapshot->Slots)
+                    if (!visit(x))
+                        break;
             }
             else {
-                for (const auto& x : _List)
-                    if (auto v = x.lock(); v)
-                        ret.push_back(std::move(v));
+                for (size_t i = 0; i < snapshot->Slots.size(); ++i)
+                    if (snapshot->Items[i].Live() && !visit(snapshot->Slots[i]))
+                        break;
+                // Even if the disconnected closure was already gone from this snapshot, compaction resyncs the count
+                _Stale.store(true, std::memory_order_relaxed);
             }
-            return ret;
+            // Compaction disconnects the closures whose object is gone; restoring the flag keeps nested emissions apart
+            if (std::exchange(_SawExpired, outer))
+                _Stale.store(true, std::memory_order_relaxed);
         }
 
-        template <class T>
-        static const auto& As(const std::shared_ptr<const void>& cls) noexcept {
-            return *reinterpret_cast<const T*>(cls.get());
+        // Calls `fn(const Slot* slots, size_t count)` once with all connected closures, while they are kept alive
+        template <class Fn>
+        void View(Fn&& fn) const {
+            ReadGuard guard(*this);
+            const auto snapshot = _Current.load(std::memory_order_acquire);
+            if (!snapshot)
+                return fn(static_cast<const Slot*>(nullptr), size_t(0));
+            if (_Registry->Disconnects.load(std::memory_order_acquire) == snapshot->Disconnects)
+                return fn(snapshot->Slots.data(), snapshot->Slots.size());
+            std::vector<Slot> live;
+            for (size_t i = 0; i < snapshot->Slots.size(); ++i)
+                if (snapshot->Items[i].Live())
+                    live.push_back(snapshot->Slots[i]);
+            _Stale.store(true, std::memory_order_relaxed);
+            fn(static_cast<const Slot*>(live.data()), live.size());
+        }
+
+        // Copies the connected closures along with the owners of the ones not inline and the objects of inline weak
+        // bindings, for an emission that outlives the call
+        void Copy(std::vector<Slot>& slots, std::vector<std::shared_ptr<A>>& owners,
+                  std::vector<WeakIntrusivePtr<IntrusiveVTBase>>& objects) const {
+            ReadGuard guard(*this);
+            const auto snapshot = _Current.load(std::memory_order_acquire);
+            if (!snapshot)
+                return;
+            slots.reserve(snapshot->Slots.size());
+            for (size_t i = 0; i < snapshot->Slots.size(); ++i)
+                if (snapshot->Items[i].Live()) {
+                    slots.push_back(snapshot->Slots[i]);
+                    if (snapshot->Items[i].Owner)
+                        owners.push_back(snapshot->Items[i].Owner);
+                    else if (snapshot->Items[i].Object)
+                        objects.push_back(WeakIntrusivePtr<IntrusiveVTBase>::Reference(snapshot->Items[i].Object,
+                                                                                       snapshot->Items[i].Object));
+                }
+            if (slots.size() != snapshot->Slots.size())
+                _Stale.store(true, std::memory_order_relaxed);
         }
     private:
-        uint64_t _Count = 0;
+        // The registry entry of a closure in a snapshot, and its owner if it is not inline
+        struct Item {
+            Registry::Entry* Entry;
+            uint32_t Generation;
+            int Priority;
+            std::shared_ptr<A> Owner;
+            // The control block of an inline weak binding, kept by the entry or the snapshot that dropped it
+            IntrusiveVTBase* Object;
+
+            bool Live() const noexcept { return Entry->Generation.load(std::memory_order_acquire) == Generation; }
+
+            // Caller holds _Lock and the item is in the current snapshot, so the entry still has its object
+            bool Expired() const noexcept {
+                return Owner ? Owner->Expired() : Object && Entry->Object.Expired();
+            }
+        };
+
+        Connection Insert(std::shared_ptr<A> owner, WeakIntrusivePtr<IntrusiveVTBase> object, const Slot& slot,
+                          int priority) {
+            const auto control = object.Control();
+            const auto [entry, generation] = _Registry->Allocate(owner, std::move(object));
+            Connection ret(_Registry, entry, generation);
+            Item add {entry, generation, priority, std::move(owner), control};
+            Snapshot* freed = nullptr;
+            try {
+                std::lock_guard<Mutex> lk(_Lock);
+                Publish(&slot, &add);
+                freed = Reclaim();
+            }
+            catch (...) {
+                ret.Disconnect();
+                throw;
+            }
+            // Outside the lock, destroying a closure may connect to or emit this delegate
+            Free(freed);
+            return ret;
+        }
+
+        struct Snapshot {
+            std::vector<Slot> Slots;
+            // Parallel to Slots, only read after a disconnection
+            std::vector<Item> Items;
+            // Registry::Disconnects before the snapshot was built from the live closures
+            uint64_t Disconnects = 0;
+            // Objects of the inline weak bindings dropped by the compaction that retired the snapshot
+            std::vector<WeakIntrusivePtr<IntrusiveVTBase>> Dropped;
+            // While retired: one bit per reader counter seen at zero since, and the next retired snapshot
+            uint8_t Drained = 0;
+            Snapshot* Next = nullptr;
+        };
+
+        class ReadGuard {
+        public:
+            explicit ReadGuard(const DelegateBase& base) noexcept : _Base(base) {
+                // Re-checking the epoch keeps a reader that was slow to announce itself off the draining counter
+                for (;;) {
+                    _Epoch = _Base._Epoch.load();
+                    _Base._Readers[_Epoch].fetch_add(1);
+                    if (_Base._Epoch.load() == _Epoch)
+                        break;
+                    _Base._Readers[_Epoch].fetch_sub(1);
+                }
+            }
+
+            ReadGuard(const ReadGuard&) = delete;
+
+            ReadGuard& operator=(const ReadGuard&) = delete;
+
+            ~ReadGuard() noexcept {
+                _Base._Readers[_Epoch].fetch_sub(1);
+                if (_Base._Stale.load(std::memory_order_relaxed) || _Base._RetiredCount.load(std::memory_order_relaxed))
+                    _Base.Maintain();
+            }
+        private:
+            const DelegateBase& _Base;
+            int _Epoch = 0;
+        };
+
+        // Caller holds _Lock. Replaces the snapshot by its live closures plus `add`, and retires the old one
+        void Publish(const Slot* add, Item* item) const {
+            const auto old = _Current.load(std::memory_order_relaxed);
+            auto next = std::make_unique<Snapshot>();
+            const auto size = (old ? old->Slots.size() : 0) + 1;
+            next->Slots.reserve(size);
+            next->Items.reserve(size);
+            for (size_t i = 0; old && i < old->Slots.size(); ++i)
+                if (const auto& x = old->Items[i]; x.Expired())
+                    _Registry->Release(x.Entry, x.Generation);
+            // Read before the generations: a disconnect in between leaves the count behind, which only costs a check
+            next->Disconnects = _Registry->Disconnects.load(std::memory_order_acquire);
+            // Readers of the old snapshot may still call the bindings it drops, it keeps their objects until freed
+            size_t held = 0;
+            for (size_t i = 0; old && i < old->Slots.size(); ++i)
+                held += old->Items[i].Object && !old->Items[i].Live();
+            if (held)
+                old->Dropped.reserve(held);
+            // The old snapshot is in order, `add` goes after the closures of its priority and above
+            for (size_t i = 0; old && i < old->Slots.size(); ++i) {
+                if (add && old->Items[i].Priority < item->Priority) {
+                    next->Slots.push_back(*add);
+                    next->Items.push_back(std::move(*item));
+                    add = nullptr;
+                }
+                if (const auto& x = old->Items[i]; !x.Live() && x.Object &&
+                                                   old->Dropped.size() < old->Dropped.capacity()) {
+                    old->Dropped.push_back(std::move(x.Entry->Object));
+                    _Registry->Recycle(x.Entry);
+                }
+                // Ones disconnected since they were counted stay for the next compaction
+                else if (x.Live() || x.Object) {
+                    next->Slots.push_back(old->Slots[i]);
+                    next->Items.push_back(x);
+                }
+            }
+            if (add) {
+                next->Slots.push_back(*add);
+                next->Items.push_back(std::move(*item));
+            }
+            _Count.store(next->Slots.size(), std::memory_order_relaxed);
+            _Current.store(next.release());
+            if (old) {
+                old->Next = _RetiredList;
+                _RetiredList = old;
+                _RetiredCount.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        // Caller holds _Lock. Unlinks the retired snapshots no reader can see anymore and returns them
+        Snapshot* Reclaim() const noexcept {
+            const uint8_t idle = (_Readers[0].load() ? 0 : 1) | (_Readers[1].load() ? 0 : 2);
+            Snapshot* freed = nullptr;
+            for (auto link = &_RetiredList; *link;) {
+                const auto x = *link;
+                if ((x->Drained |= idle) != 3) {
+                    link = &x->Next;
+                    continue;
+                }
+                *link = x->Next;
+                x->Next = freed;
+                freed = x;
+                _RetiredCount.fetch_sub(1, std::memory_order_relaxed);
+            }
+            if (_RetiredList)
+                _Epoch.store(_Epoch.load() ^ 1);
+            return freed;
+        }
+
+        // Compacts and reclaims if the lock is free; emission never waits for it
+        void Maintain() const noexcept {
+            Snapshot* freed = nullptr;
+            {
+                std::unique_lock<Mutex> lk(_Lock, std::try_to_lock);
+                if (!lk)
+                    return;
+                try {
+                    if (_Stale.exchange(false, std::memory_order_relaxed))
+                        Publish(nullptr, nullptr);
+                }
+                catch (...) {
+                    // Out of memory: keep the current snapshot, a later emission tries again
+                    _Stale.store(true, std::memory_order_relaxed);
+                }
+                freed = Reclaim();
+            }
+            Free(freed);
+        }
+
+        static void Free(Snapshot* list) noexcept {
+            while (list) {
+                const auto next = list->Next;
+                delete list;
+                list = next;
+            }
+        }
+
+        mutable std::atomic<Snapshot*> _Current {nullptr};
+        mutable std::atomic_int _Epoch {0};
+        mutable std::atomic<uint32_t> _Readers[2] {};
+        mutable std::atomic_bool _Stale {false};
+        mutable std::atomic<uint32_t> _RetiredCount {0};
+        mutable std::atomic<uint64_t> _Count {0};
+        // Shared with the connection handles, which may outlive the delegate
+        IntrusivePtr<Registry> _Registry;
+        // Guarded by _Lock
+        mutable Snapshot* _RetiredList = nullptr;
         mutable Mutex _Lock;
-        mutable std::vector<std::weak_ptr<void>> _List;
     public:
-        template <class = std::enable_if_t<std::is_copy_assignable_v<Mutex>>>
+        template <class M = Mutex, class = std::enable_if_t<std::is_copy_assignable_v<M>>>
         void SetMutex(const Mutex& mutex) { _Lock = mutex; }
 
-        template <class = std::enable_if_t<std::is_move_assignable_v<Mutex>>>
+        template <class M = Mutex, class = std::enable_if_t<std::is_move_assignable_v<M>>>
         void SetMutex(Mutex&& mutex) { _Lock = std::move(mutex); }
 
-        auto Size() const noexcept { return _Count; }
+        // Closures in the current snapshot; ones disconnected since the last compaction are still counted
+        auto Size() const noexcept { return _Count.load(std::memory_order_relaxed); }
 
-        bool Empty() const noexcept { return !static_cast<bool>(_Count); }
+        bool Empty() const noexcept { return !static_cast<bool>(Size()); }
     };
 }
 
@@ -141,74 +767,494 @@ class Delegate;
 template <class T, template<class U> class Reduce, class Mutex, class ...Args>
 class Delegate<T(Args...), Reduce, Mutex> : public  __Details::DelegateBase<Mutex> {
     using Base = __Details::DelegateBase<Mutex>;
-    struct B : Base::A { virtual T Call(Args&& ... arg) const = 0; };
+    using Target = typename Base::template Target<T, Args...>;
+    using Result = typename Reduce<T>::TargetType;
+    static constexpr bool IsVoid = std::is_same_v<Result, void>;
 
-    template <class Func>
-    struct P : B {
-        explicit P(Func&& fn)
-                :_Fc(std::move(fn)) { }
-        T Call(Args&& ... arg) const override { return _Fc(std::forward<Args>(arg)...); }
-        Func _Fc;
+    // Closures running in parallel each get a copy of the arguments taken by value, rvalues are not moved from
+    template <class U>
+    using Copy = std::conditional_t<std::is_lvalue_reference_v<U>, U, std::remove_cv_t<std::remove_reference_t<U>>>;
+
+    static auto Initial() { return __Details::ReduceInitial<Reduce<T>>(); }
+
+    template <class Out, class V>
+    static bool Feed(Reduce<T>& reduce, Out& out, V&& value) {
+        return __Details::ReduceFeed(reduce, out, std::forward<V>(value));
+    }
+
+    // The reduced result of one range, and whether any closure in it ran
+    struct Part {
+        decltype(Initial()) Value = Initial();
+        bool Ran = false;
+    };
+
+    template <class Call>
+    static void RunRange(const typename Base::Slot* slots, size_t begin, size_t end, Part& part, Call&& call) {
+        if constexpr (IsVoid) {
+            for (auto i = begin; i < end; ++i)
+                call(slots[i]);
+        }
+        else {
+            Reduce<T> reduce;
+            for (auto i = begin; i < end && Feed(reduce, part.Value, call(slots[i])); ++i) {}
+            part.Ran = begin < end;
+        }
+    }
+
+    static Result Combine(std::vector<Part>& parts) {
+        if constexpr (!IsVoid) {
+            auto ret = Initial();
+            Reduce<T> reduce;
+            for (auto& x : parts)
+                if (x.Ran && !Feed(reduce, ret, std::move(x.Value)))
+                    break;
+            return ret;
+        }
+    }
+
+    // State of an emission that returns a future; it owns the closures and the arguments until the last range ends
+    struct Emission {
+        std::vector<typename Base::Slot> Slots;
+        std::vector<std::shared_ptr<typename Base::A>> Owners;
+        std::vector<WeakIntrusivePtr<IntrusiveVTBase>> Objects;
+        std::tuple<Copy<Args>...> Arguments;
+        std::vector<Part> Parts;
+        std::atomic<size_t> Remaining {0};
+        std::exception_ptr Error;
+        std::mutex Lock;
+        std::promise<Result> Promise;
+
+        explicit Emission(Args&... arg) : Arguments(static_cast<Copy<Args>>(arg)...) {}
+
+        void Finish() {
+            if (Error)
+                return Promise.set_exception(Error);
+            try {
+                if constexpr (IsVoid)
+                    Promise.set_value();
+                else
+                    Promise.set_value(Combine(Parts));
+            }
+            catch (...) {
+                Promise.set_exception(std::current_exception());
+            }
+        }
     };
 public:
+    // Closures of higher priority run first, ones of the same priority in the order they were connected
+    template <class Func>
+    Connection Connect(Func&& fn, int priority = 0) {
+        return Base::Add(Target::Make(std::decay_t<Func>(std::forward<Func>(fn))), priority);
+    }
+
+    /**
+     * \brief Connects a closure that runs on the thread owning `target`. Emitting on that thread calls it directly,
+     *        emitting elsewhere posts the call, with copies of the arguments, and the owner runs it on its next
+     *        Mailbox::drain unless it was disconnected by then. Arguments taken by reference to non-const are not
+     *        allowed, as the call would outlive them. Once the mailbox is destroyed, the closure is no longer
+     *        called and the connection is dropped like a disconnected one
+     */
     template <class Func>
-    Connection Connect(Func&& fn) {
-        return Base::template Add<B>(std::make_shared<P<std::decay_t<Func>>>(std::forward<Func>(fn)));
+    Connection Connect(Mailbox& target, Func&& fn, int priority = 0) {
+        return Base::Add(Target::MakeAffine(target, std::decay_t<Func>(std::forward<Func>(fn))), priority);
+    }
+
+    // Calls `(object->*method)(args...)`; the binding is stored in the slot, the object must outlive the connection
+    template <class C, class Method, class = std::enable_if_t<std::is_member_function_pointer_v<Method>>>
+    Connection Connect(C* object, Method method, int priority = 0) {
+        return Connect([object, method](Args... arg) -> T { return (object->*method)(std::forward<Args>(arg)...); },
+                       priority);
+    }
+
+    /**
+     * \brief Calls `(object->*method)(args...)` while the object is alive. The slot keeps the raw pointers and each
+     *        call takes a strong reference for its duration; once the object is gone the call is skipped, with a
+     *        value-initialized result, and the connection is dropped on a later compaction
+     */
+    template <class C, class Method, class = std::enable_if_t<std::is_member_function_pointer_v<Method>>>
+    Connection Connect(const WeakIntrusivePtr<C>& object, Method method, int priority = 0) {
+        return Base::Add(Target::MakeWeak(object, method), priority);
     }
 
     auto operator()(Args... arg) const {
-        auto locked = Base::template ListValidsAndCompress();
         if constexpr(std::is_same_v<typename Reduce<T>::TargetType, void>) {
-            for (const auto& x : locked)
-                Base::template As<B>(x).Call(std::forward<Args>(arg)...);
+            Base::ForEach([&](const auto& x) { Target::Call(x, std::forward<Args>(arg)...); });
         }
         else {
-            typename Reduce<T>::TargetType ret{};
+            auto ret = Initial();
             Reduce<T> reduce;
-            for (const auto& x : locked)
-                reduce(ret, Base::template As<B>(x).Call(std::forward<Args>(arg)...));
+            Base::ForEach([&](const auto& x) { return Feed(reduce, ret, Target::Call(x, std::forward<Args>(arg)...)); });
             return ret;
         }
     }
+
+    /**
+     * \brief Runs the closures on `pool` and the calling thread, one contiguous range of them per thread, and
+     *        returns the reduced result once all are done. The closures must be safe to run concurrently, and
+     *        unless the result is ignored the Reduce policy has to be Associative
+     * \note  Rethrows the first exception thrown by a closure once all ranges are done
+     */
+    auto Parallel(WorkerPool& pool, Args... arg) const {
+        static_assert(IsVoid || __Details::IsAssociative<Reduce<T>>::value,
+                      "Parallel emission needs a Reduce policy declared Associative");
+        std::vector<Part> parts;
+        Base::View([&](const auto* slots, size_t count) {
+            const auto ranges = std::min(count, pool.size() + 1);
+            parts.resize(ranges);
+            pool.parallelFor(ranges, [&](size_t r) {
+                RunRange(slots, count * r / ranges, count * (r + 1) / ranges, parts[r], [&](const auto& x) {
+                    return Target::Call(x, static_cast<Copy<Args>>(arg)...);
+                });
+            });
+        });
+        return Combine(parts);
+    }
+
+    /**
+     * \brief Like Parallel, but only the workers of `pool` run the closures, and the result is delivered through
+     *        the returned future. The closures connected now are kept alive until they ran, arguments taken by
+     *        value are copied, and ones taken by reference have to stay valid until the future is ready
+     */
+    std::future<Result> ParallelAsync(WorkerPool& pool, Args... arg) const {
+        static_assert(IsVoid || __Details::IsAssociative<Reduce<T>>::value,
+                      "Parallel emission needs a Reduce policy declared Associative");
+        const auto emission = std::make_shared<Emission>(arg...);
+        auto ret = emission->Promise.get_future();
+        Base::Copy(emission->Slots, emission->Owners, emission->Objects);
+        const auto count = emission->Slots.size();
+        const auto ranges = std::min(count, std::max<size_t>(pool.size(), 1));
+        if (!ranges) {
+            emission->Finish();
+            return ret;
+        }
+        emission->Parts.resize(ranges);
+        emission->Remaining.store(ranges);
+        for (size_t r = 0; r < ranges; ++r)
+            pool.post([emission, r, begin = count * r / ranges, end = count * (r + 1) / ranges]() {
+                auto& e = *emission;
+                try {
+                    RunRange(e.Slots.data(), begin, end, e.Parts[r], [&](const auto& x) {
+                        return std::apply([&](auto&... a) { return Target::Call(x, static_cast<Copy<Args>>(a)...); },
+                                          e.Arguments);
+                    });
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lk(e.Lock);
+                    if (!e.Error)
+                        e.Error = std::current_exception();
+                }
+                if (e.Remaining.fetch_sub(1) == 1)
+                    e.Finish();
+            });
+        return ret;
+    }
 };
 
+/*
+ * Handlers are kept per message type, in buckets indexed by typeId<Message>(), so a cast only visits the handlers
+ * of its own type. Casting finds the bucket without a lock: the table only grows, and tables it outgrew are kept
+ * until the signal is destroyed, so a cast never sees one freed; together they take at most twice the last one.
+ */
 template <class Sender, class Mutex = std::mutex>
-class GenericSignal :  public  __Details::DelegateBase<Mutex> {
-    using Base = __Details::DelegateBase<Mutex>;
-
-    template <class Message>
-    struct B : Base::A { virtual void Call(Sender& sender, const Message& message) const = 0; };
+class GenericSignal {
+    struct Bucket : __Details::DelegateBase<Mutex> {
+        using Base = __Details::DelegateBase<Mutex>;
+        template <class Message>
+        using Target = typename Base::template Target<void, Sender&, const Message&>;
+        using Base::Add;
+        using Base::ForEach;
+    };
 
-    template <class Message, class Func>
-    struct P : B<Message> {
-        explicit P(Func&& fn)
-                :_Fc(std::move(fn)) { }
-        void Call(Sender& sender, const Message& message) const override { _Fc(sender, message); }
-        Func _Fc;
+    struct Table {
+        explicit Table(size_t size) : Buckets(new std::atomic<Bucket*>[size]()), Size(size) {}
+        std::unique_ptr<std::atomic<Bucket*>[]> Buckets;
+        size_t Size;
     };
 public:
+    GenericSignal() = default;
+
+    GenericSignal(const GenericSignal&) = delete;
+
+    GenericSignal& operator=(const GenericSignal&) = delete;
+
+    template <class Message, class Func>
+    Connection ConnectUnsafe(Func&& fn, int priority = 0) {
+        using Target = typename Bucket::template Target<Message>;
+        return Get(typeId<Message>()).Add(Target::Make(std::decay_t<Func>(std::forward<Func>(fn))), priority);
+    }
+
+    // Runs `fn(message)` on the thread owning `target`, see Delegate::Connect. The message is copied; the sender
+    // is left out, since it need not be alive by the time a posted call runs
     template <class Message, class Func>
-    Connection ConnectUnsafe(Func&& fn) {
-        return Base::template Add<B<Message>>(std::make_shared<P<Message, std::decay_t<Func>>>(std::forward<Func>(fn)));
+    Connection ConnectUnsafe(Mailbox& target, Func&& fn, int priority = 0) {
+        using Target = typename Bucket::template Target<Message>;
+        return Get(typeId<Message>()).Add(
+                Target::template MakeAffine<1>(target, std::decay_t<Func>(std::forward<Func>(fn))), priority);
+    }
+
+    // Calls `(object->*method)(sender, message)` while the object is alive, see Delegate::Connect
+    template <class Message, class C, class Method>
+    Connection ConnectUnsafe(const WeakIntrusivePtr<C>& object, Method method, int priority = 0) {
+        using Target = typename Bucket::template Target<Message>;
+        return Get(typeId<Message>()).Add(Target::MakeWeak(object, method), priority);
     }
 
     template <class Message>
     void CastUnsafe(Sender& sender, const Message& message) const {
-        auto locked = Base::template ListValidsAndCompress();
-        for (const auto& x : locked)
-            Base::template As<B<Message>>(x).Call(sender, message);
+        using Target = typename Bucket::template Target<Message>;
+        if (const auto bucket = Find(typeId<Message>()); bucket)
+            bucket->ForEach([&](const auto& x) { Target::Call(x, sender, message); });
+    }
+
+    // Handlers of Message; ones disconnected since the last compaction are still counted
+    template <class Message>
+    size_t Size() const noexcept {
+        const auto bucket = Find(typeId<Message>());
+        return bucket ? static_cast<size_t>(bucket->Size()) : 0;
+    }
+
+    // Handlers of all message types
+    size_t Size() const {
+        std::lock_guard<Mutex> lk(_Lock);
+        size_t ret = 0;
+        for (auto& x : _Buckets)
+            ret += static_cast<size_t>(x->Size());
+        return ret;
+    }
+
+    template <class Message>
+    bool Empty() const noexcept { return !Size<Message>(); }
+
+    bool Empty() const { return !Size(); }
+private:
+    Bucket* Find(size_t id) const noexcept {
+        const auto table = _Table.load(std::memory_order_acquire);
+        return table && id < table->Size ? table->Buckets[id].load(std::memory_order_acquire) : nullptr;
+    }
+
+    Bucket& Get(size_t id) {
+        if (const auto bucket = Find(id); bucket)
+            return *bucket;
+        std::lock_guard<Mutex> lk(_Lock);
+        auto table = _Table.load(std::memory_order_relaxed);
+        if (!table || id >= table->Size) {
+            auto next = std::make_unique<Table>(std::max<size_t>({id + 1, table ? table->Size * 2 : 0, 8}));
+            for (size_t i = 0; table && i < table->Size; ++i)
+                next->Buckets[i].store(table->Buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            table = next.get();
+            _Tables.push_back(std::move(next));
+            _Table.store(table, std::memory_order_release);
+        }
+        if (const auto bucket = table->Buckets[id].load(std::memory_order_relaxed); bucket)
+            return *bucket;
+        _Buckets.push_back(std::make_unique<Bucket>());
+        table->Buckets[id].store(_Buckets.back().get(), std::memory_order_release);
+        return *_Buckets.back();
     }
+
+    std::atomic<Table*> _Table {nullptr};
+    // Guarded by _Lock: every table so far, the current one last, and the buckets they point to
+    std::vector<std::unique_ptr<Table>> _Tables;
+    std::vector<std::unique_ptr<Bucket>> _Buckets;
+    mutable Mutex _Lock;
 };
 
 template <class Sender, class Message, class Mutex = std::mutex>
 class Signal : public GenericSignal<Sender, Mutex> {
+    using Base = GenericSignal<Sender, Mutex>;
 public:
     template <class Func>
-    Connection Connect(Func&& fn) {
-        return GenericSignal<Sender>::template ConnectUnsafe<Message, Func>(std::forward<Func>(fn));
+    Connection Connect(Func&& fn, int priority = 0) {
+        return Base::template ConnectUnsafe<Message>(std::forward<Func>(fn), priority);
     }
 
-    void operator()(Sender& sender, const Message& message) const {
-        GenericSignal<Sender>::template CastUnsafe(sender, message);
+    template <class Func>
+    Connection Connect(Mailbox& target, Func&& fn, int priority = 0) {
+        return Base::template ConnectUnsafe<Message>(target, std::forward<Func>(fn), priority);
+    }
+
+    template <class C, class Method>
+    Connection Connect(const WeakIntrusivePtr<C>& object, Method method, int priority = 0) {
+        return Base::template ConnectUnsafe<Message>(object, method, priority);
+    }
+
+    void operator()(Sender& sender, const Message& message) const { Base::CastUnsafe(sender, message); }
+
+    size_t Size() const noexcept { return Base::template Size<Message>(); }
+
+    bool Empty() const noexcept { return !Size(); }
+};
+
+/**
+ * \brief Collects messages of any type until Flush, which hands the ones of each type to its handlers as one array:
+ *        every handler runs once per message type and flush instead of once per message. Messages keep the order
+ *        they were cast in within their type; the types are delivered in the order they were first seen.
+ *        Cast and Connect may be called from any thread and from the handlers; messages cast while a flush is
+ *        delivering are left for the next one
+ */
+template <class Sender, class Mutex = std::mutex>
+class QueuedSignal {
+    struct QueueBase {
+        virtual ~QueueBase() noexcept = default;
+        virtual void Deliver(Sender& sender, Mutex& lock) = 0;
+    };
+
+    template <class Message>
+    struct Queue : QueueBase {
+        // Swaps the pending messages out under the lock and hands them over outside of it, so that handlers may
+        // cast; the emptied buffer is put back afterwards if nothing was cast meanwhile, to keep its capacity
+        void Deliver(Sender& sender, Mutex& lock) override {
+            std::vector<Message> batch;
+            {
+                std::lock_guard<Mutex> lk(lock);
+                batch.swap(_Pending);
+            }
+            if (batch.empty())
+                return;
+            _Handlers(sender, Span<const Message>(batch.data(), batch.size()));
+            batch.clear();
+            std::lock_guard<Mutex> lk(lock);
+            if (_Pending.empty())
+                _Pending.swap(batch);
+        }
+
+        std::vector<Message> _Pending;
+        Delegate<void(Sender&, Span<const Message>), LastValue, Mutex> _Handlers;
+    };
+public:
+    QueuedSignal() = default;
+
+    QueuedSignal(const QueuedSignal&) = delete;
+
+    QueuedSignal& operator=(const QueuedSignal&) = delete;
+
+    // `fn(Sender&, Span<const Message>)` is called with the messages of its type on every flush that has some
+    template <class Message, class Func>
+    Connection Connect(Func&& fn, int priority = 0) {
+        Queue<Message>* queue;
+        {
+            std::lock_guard<Mutex> lk(_Lock);
+            queue = &Get<Message>();
+        }
+        return queue->_Handlers.Connect(std::forward<Func>(fn), priority);
+    }
+
+    template <class Message>
+    void Cast(Message&& message) {
+        std::lock_guard<Mutex> lk(_Lock);
+        Get<std::decay_t<Message>>()._Pending.emplace_back(std::forward<Message>(message));
+    }
+
+    // Delivers the messages cast so far, type by type
+    void Flush(Sender& sender) {
+        std::vector<QueueBase*> queues;
+        {
+            std::lock_guard<Mutex> lk(_Lock);
+            queues = _Order;
+        }
+        for (auto x : queues)
+            x->Deliver(sender, _Lock);
     }
-};
\ No newline at end of file
+private:
+    // Caller holds _Lock
+    template <class Message>
+    Queue<Message>& Get() {
+        const auto id = typeId<Message>();
+        if (id >= _Queues.size())
+            _Queues.resize(id + 1);
+        auto& slot = _Queues[id];
+        if (!slot) {
+            slot = std::make_unique<Queue<Message>>();
+            _Order.push_back(slot.get());
+        }
+        return static_cast<Queue<Message>&>(*slot);
+    }
+
+    // Indexed by typeId; queues are never removed, so references to them stay valid without the lock
+    std::vector<std::unique_ptr<QueueBase>> _Queues;
+    std::vector<QueueBase*> _Order;
+    Mutex _Lock;
+};
+
+/**
+ * \brief A signal whose handlers are plain functions fixed when the program starts: no locks, reference counts or
+ *        allocation on emission, which calls through one contiguous table of function pointers.
+ *        Handlers are added by STATIC_CONNECT during static initialization and are never removed; registering
+ *        later is only safe before the signal is emitted or shared with other threads. The table is kept by Core,
+ *        so handlers connected by any module are emitted from all of them; a module that connects handlers must
+ *        not be unloaded.
+ *        Handlers listed in With<...> are known at compile time and emitted as direct calls the optimizer can
+ *        inline, ahead of the registered ones.
+ * \tparam Tag Tells signals with the same signature apart
+ */
+template <class Tag, class T, template <class U> class Reduce = LastValue>
+class StaticSignal;
+
+namespace __Details {
+    // The handlers of a StaticSignal, with their type erased. Kept by Core, so every module sees the same table
+    struct StaticTable {
+        struct Entry {
+            void (*Fn)();
+            int Priority;
+        };
+        Entry* Entries = nullptr;
+        size_t Size = 0, Capacity = 0;
+    };
+
+    // The table of the signal type, created empty on first use; it lives as long as the program
+    NWCOREAPI StaticTable& staticTable(const std::type_info& signal);
+
+    NWCOREAPI void staticConnect(StaticTable& table, void (*fn)(), int priority);
+}
+
+template <class Tag, class T, template <class U> class Reduce, class ...Args>
+class StaticSignal<Tag, T(Args...), Reduce> {
+public:
+    using Handler = T (*)(Args...);
+
+    StaticSignal() = delete;
+
+    // Handlers of higher priority run first, ones of the same priority in the order they were registered. The
+    // order of registrations from different translation units is unspecified, priorities make it deterministic
+    static void Connect(Handler fn, int priority = 0) {
+        __Details::staticConnect(Table(), reinterpret_cast<void (*)()>(fn), priority);
+    }
+
+    static auto Emit(Args... arg) { return With<>::Emit(std::forward<Args>(arg)...); }
+
+    static size_t Size() { return Table().Size; }
+
+    static bool Empty() { return !Size(); }
+
+    template <Handler... Fn>
+    struct With {
+        static auto Emit(Args... arg) {
+            const auto& table = Table();
+            if constexpr (std::is_void_v<typename Reduce<T>::TargetType>) {
+                (Fn(std::forward<Args>(arg)...), ...);
+                for (auto x = table.Entries, end = table.Entries + table.Size; x != end; ++x)
+                    reinterpret_cast<Handler>(x->Fn)(std::forward<Args>(arg)...);
+            }
+            else {
+                auto ret = __Details::ReduceInitial<Reduce<T>>();
+                Reduce<T> reduce;
+                if ((__Details::ReduceFeed(reduce, ret, Fn(std::forward<Args>(arg)...)) && ...))
+                    for (auto x = table.Entries, end = table.Entries + table.Size; x != end; ++x)
+                        if (!__Details::ReduceFeed(reduce, ret, reinterpret_cast<Handler>(x->Fn)(
+                                std::forward<Args>(arg)...)))
+                            break;
+                return ret;
+            }
+        }
+    };
+private:
+    // Looked up by the type in Core, as a table in each module would only see the handlers of that module. The
+    // local static makes it ready for a registration from the static initialization of any translation unit
+    static __Details::StaticTable& Table() {
+        static auto& table = __Details::staticTable(typeid(StaticSignal));
+        return table;
+    }
+};
+
+// Connects a handler to a StaticSignal during static initialization, as STATIC_CONNECT(Signal, &fn[, priority])
+#define STATIC_CONNECT(signal, ...) BGEIN_STATIC_INIT_RUN() signal::Connect(__VA_ARGS__); END_STATIC_INIT_RUN
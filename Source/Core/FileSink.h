@@ -0,0 +1,127 @@
+//
+// Core: FileSink.h
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include "LogSink.h"
+
+/**
+ * \brief Appends records to a file in batches. Records are collected in memory and written with one
+ *        system call per batch, when the batch is large enough, old enough, or contains an urgent record.
+ *        With rotation enabled the file is closed and renamed to `<name>.<n>.log` when it grows past `maxBytes` or
+ *        a `rotateInterval` boundary of the wall clock passes, and a fresh file is opened under the original path.
+ *        Closed files are gzip-compressed (when built with zlib) and pruned on a worker thread owned by the sink
+ */
+class NWCOREAPI FileSink : public LogSink {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // When the data is forced to the disk with fdatasync
+    enum class Sync {
+        never,   // Leave it to the operating system
+        onError, // After writing a batch that contains a record at or above `flushLevel`
+        periodic // At most once per `syncInterval`, and on urgent records
+    };
+
+    struct Options {
+        // Flush once this many bytes are buffered
+        size_t batchBytes = 64 * 1024;
+        // Flush once the oldest buffered record is this old
+        std::chrono::milliseconds flushInterval{200};
+        // Records at or above this level are flushed immediately
+        Logger::Level flushLevel = Logger::Level::error;
+        Sync sync = Sync::onError;
+        std::chrono::milliseconds syncInterval{1000};
+        // Rotate before the file would grow past this many bytes, 0 to disable
+        uint64_t maxBytes = 0;
+        // Rotate at every multiple of this interval since the epoch (UTC), 0 to disable
+        std::chrono::seconds rotateInterval{0};
+        // Number of rotated files to keep, 0 to keep all of them. Rotations of the same path left by earlier runs
+        // are found at startup and count towards it
+        size_t retention = 0;
+        // Compress rotated files, ignored when zlib is not available
+        bool compress = true;
+    };
+
+    struct Stats {
+        uint64_t records, bytes, batches, syncs;
+        // Time spent in write and sync calls
+        std::chrono::nanoseconds flushTotal, flushMax;
+        uint64_t rotations;
+        // Time the writing thread spent closing, renaming and reopening the file
+        std::chrono::nanoseconds rotateTotal, rotateMax;
+        // Sizes of the rotated files before and after compression
+        uint64_t compressedIn, compressedOut;
+        // Records dropped because the file could not be opened or written
+        uint64_t lost;
+
+        double compressionRatio() const noexcept {
+            return compressedIn ? static_cast<double>(compressedOut) / compressedIn : 1.0;
+        }
+    };
+
+    explicit FileSink(const std::string& path);
+
+    FileSink(const std::string& path, Options options);
+
+    ~FileSink() override;
+
+    void write(const LogRecord& record) override;
+
+    void flush() override;
+
+    void idle() override;
+
+    Stats stats() const noexcept;
+
+    const std::string& path() const noexcept { return mPath; }
+protected:
+    // Queues the bytes of one record, for sinks that format records differently but share the batching
+    void append(std::string_view bytes, bool urgent);
+
+    const Options& options() const noexcept { return mOptions; }
+private:
+    class Archiver;
+
+    void writeOut(std::string_view extra = {});
+    void fail(const char* what) noexcept;
+    void rotate();
+    void rotateIfDue(size_t incoming);
+    void scheduleRotation() noexcept;
+
+    std::string mPath;
+    Options mOptions;
+    int mFile = -1;
+    std::string mBuffer;
+    Clock::time_point mFirst{}, mLastSync{};
+    bool mUrgent = false, mDirty = false, mFailed = false;
+    // Records in mBuffer
+    uint64_t mPending = 0;
+    std::atomic<uint64_t> mRecords{0}, mBytes{0}, mBatches{0}, mSyncs{0}, mFlushTotal{0}, mFlushMax{0}, mLost{0};
+    // Rotation state, only touched by the writing thread
+    uint64_t mFileBytes = 0;
+    uint64_t mSequence = 0;
+    std::chrono::system_clock::time_point mRotateAt{};
+    std::atomic<uint64_t> mRotations{0}, mRotateTotal{0}, mRotateMax{0};
+    std::unique_ptr<Archiver> mArchiver;
+};
@@ -0,0 +1,70 @@
+//
+// Core: FlightRecorder.h
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include "Config.h"
+#include "Logger.h"
+
+/**
+ * \brief Keeps the last records of every thread in memory, including the ones filtered out of the sinks, and dumps
+ *        them merged by time when something goes wrong: a failed assertion, a fatal record or a fatal signal.
+ *        Each thread writes into a ring of fixed-size slots it owns, so recording takes no lock and no allocation.
+ *        A dump only writes the records that were not part of a previous dump
+ */
+class NWCOREAPI FlightRecorder {
+public:
+    /**
+     * \brief Start recording. The dump file is opened here so that dumping from a signal handler needs no allocation
+     * \param path File the dumps are appended to
+     * \param level Lowest level to record; lowers the Logger gate when below the levels of the outputs
+     * \param slots Number of records kept per thread
+     * \param slotBytes Longest record kept, longer records are truncated
+     * \param signals Install handlers for SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT that dump before the
+     *        default action runs
+     */
+    static void enable(const std::string& path, Logger::Level level = Logger::Level::verbose, size_t slots = 1024,
+                       size_t slotBytes = 256, bool signals = true);
+
+    static bool captures(Logger::Level level) noexcept {
+        return static_cast<int>(level) >= capture.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Copy a record into the ring of the calling thread. Called by the Logger for every captured record
+     */
+    static void record(std::string_view text) noexcept;
+
+    /**
+     * \brief Merge the rings by time and append the records not dumped yet to the dump file.
+     *        Async-signal-safe; does nothing when recording was not enabled or another dump is running
+     */
+    static void dump(const char* reason) noexcept;
+
+    /**
+     * \brief Number of records that could not be kept because every ring was taken by a live thread
+     */
+    static uint64_t lostCount() noexcept;
+private:
+    // Lowest recorded level, past `fatal` while disabled
+    static std::atomic_int capture;
+};
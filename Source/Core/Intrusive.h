@@ -22,6 +22,8 @@
 #include <new>
 #include <atomic>
 #include <limits>
+#include <cstdint>
+#include <utility>
 #include <type_traits>
 
 template <class IntrusiveType> class IntrusivePtr;
@@ -57,13 +59,13 @@ class IntrusiveVTBase {
         }
     }
 
-    // Release Control, decrease strong count and check if the object is good to release
+    // Release Control, decrease strong count and check if the object is good to release.
+    // The strong references together hold one weak reference, so that the memory outlives the destructor
     void TryRelease() noexcept {
-        auto last = _Ctrl.fetch_sub(uint64_t(1) << 32);
-        if (last >> 32 == 0)
+        if (_Ctrl.fetch_sub(uint64_t(1) << 32) >> 32 == 1) {
             this->~IntrusiveVTBase();
-        if (last == uint64_t(1) << 32)
-            SelfDealloc();
+            TryDereference();
+        }
     }
     // Release Reference, decrease weak count and check if the object is good to release
     void TryDereference() noexcept { if( _Ctrl.fetch_sub(1)==1) SelfDealloc(); }
@@ -71,7 +73,7 @@ class IntrusiveVTBase {
     // Strong References uses the top 32 bits and weak on the lower 32 bits
     // In this case, we cannot manage more than 2^32 - 1 references on sync, but trust me that is absolutely more than
     // enough on most cases
-    mutable std::atomic_uint64_t _Ctrl;
+    mutable std::atomic_uint64_t _Ctrl {0};
 
     // We need to know this to do actual deallocation
     // Yes this IS RTTI info, but we cannot do dynamic reflection with current standard
@@ -107,50 +109,50 @@ public:
             : _Ctrl(r._Ctrl), _Val(r._Val) { r._Ctrl = nullptr; }
 
     IntrusivePtr& operator=(const IntrusivePtr& r) noexcept {
-        if (this != std::addressof(r)) {
-            _Ctrl = r._Ctrl;
-            _Val = r._Val;
-            if (_Ctrl) _Ctrl->Acquire();
-        }
+        IntrusivePtr(r).Swap(*this);
         return *this;
     }
 
     template <class Other, class = std::enable_if_t<std::is_convertible_v<Other*, IntrusiveType*>>>
     IntrusivePtr& operator=(const IntrusivePtr<Other>& r) noexcept {
-        if (this != std::addressof(r)) {
-            _Ctrl = r._Ctrl;
-            _Val = r._Val;
-            if (_Ctrl) _Ctrl->Acquire();
-        }
+        IntrusivePtr(r).Swap(*this);
         return *this;
     }
 
     IntrusivePtr& operator=(IntrusivePtr&& r) noexcept {
-        if (this != std::addressof(r)) {
-            _Ctrl = r._Ctrl;
-            _Val = r._Val;
-            r._Ctrl = nullptr;
-        }
+        IntrusivePtr(std::move(r)).Swap(*this);
         return *this;
     }
 
     template <class Other, class = std::enable_if_t<std::is_convertible_v<Other*, IntrusiveType*>>>
     IntrusivePtr& operator=(IntrusivePtr<Other>&& r) noexcept {
-        if (this != std::addressof(r)) {
-            _Ctrl = r._Ctrl;
-            _Val = r._Val;
-            r._Ctrl = nullptr;
-        }
+        IntrusivePtr(std::move(r)).Swap(*this);
         return *this;
     }
 
     ~IntrusivePtr() noexcept { if (_Ctrl) _Ctrl->TryRelease(); }
 
+    void Swap(IntrusivePtr& r) noexcept {
+        std::swap(_Ctrl, r._Ctrl);
+        std::swap(_Val, r._Val);
+    }
+
     explicit operator bool() const noexcept { return _Ctrl; }
 
     ElementType* Get() const noexcept { return _Val; }
 
-    auto UseCount() const noexcept { return _Ctrl->Count(); }
+    auto UseCount() const noexcept { return _Ctrl ? _Ctrl->Count() : 0; }
+
+    // For holders that cache the raw pointers of a WeakIntrusivePtr they keep: a strong reference to `value` if
+    // it is still alive, else null
+    static IntrusivePtr Lock(IntrusiveVTBase* ctrl, ElementType* value) noexcept {
+        IntrusivePtr ret {};
+        if (ctrl && ctrl->Lock()) {
+            ret._Ctrl = ctrl;
+            ret._Val = value;
+        }
+        return ret;
+    }
 
     ElementType& operator*() const noexcept { return *_Val; }
 
@@ -160,15 +162,18 @@ private:
     friend IntrusivePtr<U> MakeIntrusive(Args&&... args);
 
     template <class T>
-    friend class WeakIntrusivePointer;
+    friend class IntrusivePtr;
+
+    template <class T>
+    friend class WeakIntrusivePtr;
 
     template <class = std::enable_if_t<std::is_convertible_v<IntrusiveType*, IntrusiveVTBase*>>>
     explicit IntrusivePtr(IntrusiveType* unmanaged) noexcept
-            :_Ctrl(unmanaged), _Val(unmanaged) { _Ctrl->Acquire(); }
+            :_Ctrl(unmanaged), _Val(unmanaged) { _Ctrl->Acquire(); _Ctrl->Reference(); }
 
     template <class Other, class = std::enable_if_t<std::is_convertible_v<Other*, IntrusiveType*>>>
     explicit IntrusivePtr(Other* unmanaged) noexcept
-            : _Ctrl(unmanaged), _Val(unmanaged) { _Ctrl->Acquire(); }
+            : _Ctrl(unmanaged), _Val(unmanaged) { _Ctrl->Acquire(); _Ctrl->Reference(); }
 
     IntrusiveVTBase* _Ctrl = nullptr;
     ElementType* _Val = nullptr;
@@ -216,70 +221,74 @@ public:
     : _Ctrl(r._Ctrl), _Val(r._Val) { r._Ctrl = nullptr; }
 
     WeakIntrusivePtr& operator=(const WeakIntrusivePtr& r) noexcept {
-        if (this != std::addressof(r)) {
-            _Ctrl = r._Ctrl;
-            _Val = r._Val;
-            if (_Ctrl) _Ctrl->Reference();
-        }
+        WeakIntrusivePtr(r).Swap(*this);
         return *this;
     }
 
     template <class Other, class = std::enable_if_t<std::is_convertible_v<Other*, IntrusiveType*>>>
     WeakIntrusivePtr& operator=(const WeakIntrusivePtr<Other>& r) noexcept {
-        if (this != std::addressof(r)) {
-            _Ctrl = r._Ctrl;
-            _Val = r._Val;
-            if (_Ctrl) _Ctrl->Reference();
-        }
+        WeakIntrusivePtr(r).Swap(*this);
         return *this;
     }
 
     template <class Other, class = std::enable_if_t<std::is_convertible_v<Other*, IntrusiveType*>>>
     WeakIntrusivePtr& operator=(const IntrusivePtr<Other>& r) noexcept {
-        if (this != std::addressof(r)) {
-            _Ctrl = r._Ctrl;
-            _Val = r._Val;
-            if (_Ctrl) _Ctrl->Reference();
-        }
+        WeakIntrusivePtr(r).Swap(*this);
         return *this;
     }
 
     WeakIntrusivePtr& operator=(WeakIntrusivePtr&& r) noexcept {
-        if (this != std::addressof(r)) {
-            _Ctrl = r._Ctrl;
-            _Val = r._Val;
-            r._Ctrl = nullptr;
-        }
+        WeakIntrusivePtr(std::move(r)).Swap(*this);
         return *this;
     }
 
     template <class Other, class = std::enable_if_t<std::is_convertible_v<Other*, IntrusiveType*>>>
     WeakIntrusivePtr& operator=(WeakIntrusivePtr<Other>&& r) noexcept {
-        if (this != std::addressof(r)) {
-            _Ctrl = r._Ctrl;
-            _Val = r._Val;
-            r._Ctrl = nullptr;
-        }
+        WeakIntrusivePtr(std::move(r)).Swap(*this);
         return *this;
     }
 
     ~WeakIntrusivePtr() noexcept { if (_Ctrl) _Ctrl->TryDereference(); }
 
-    auto UseCount() const noexcept { return _Ctrl->Count(); }
+    void Swap(WeakIntrusivePtr& r) noexcept {
+        std::swap(_Ctrl, r._Ctrl);
+        std::swap(_Val, r._Val);
+    }
+
+    auto UseCount() const noexcept { return _Ctrl ? _Ctrl->Count() : 0; }
 
     bool Expired() const noexcept { return !UseCount(); }
 
+    // The raw pointers, only valid while this reference is kept; see IntrusivePtr::Lock
+    IntrusiveVTBase* Control() const noexcept { return _Ctrl; }
+
+    ElementType* Pointer() const noexcept { return _Val; }
+
+    // Another weak reference from the raw pointers of one that is known to be kept meanwhile
+    static WeakIntrusivePtr Reference(IntrusiveVTBase* ctrl, ElementType* value) noexcept {
+        WeakIntrusivePtr ret {};
+        if (ctrl) {
+            ctrl->Reference();
+            ret._Ctrl = ctrl;
+            ret._Val = value;
+        }
+        return ret;
+    }
+
     IntrusivePtr<IntrusiveType> Lock() const noexcept {
         IntrusivePtr<IntrusiveType> ret {};
-        if (bool res = _Ctrl->Lock(); res) {
+        if (bool res = _Ctrl && _Ctrl->Lock(); res) {
             ret._Ctrl = _Ctrl;
             ret._Val = _Val;
         }
         return ret;
     }
 private:
-    IntrusiveVTBase* _Ctrl;
-    ElementType* _Val;
+    template <class T>
+    friend class WeakIntrusivePtr;
+
+    IntrusiveVTBase* _Ctrl = nullptr;
+    ElementType* _Val = nullptr;
 };
 
 template <class T, class U>
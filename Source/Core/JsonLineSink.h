@@ -0,0 +1,45 @@
+//
+// Core: JsonLineSink.h
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <string>
+#include "FileSink.h"
+
+/**
+ * \brief Writes one JSON object per line:
+ *        `{"time":"2018-01-01T00:00:00.000000Z","level":"info","component":"Core","thread":42,"message":"...",
+ *        "fields":{...}}`, with `fields` only present when the record has any. Batching and rotation work
+ *        as in FileSink
+ */
+class NWCOREAPI JsonLineSink : public FileSink {
+public:
+    explicit JsonLineSink(const std::string& path);
+
+    JsonLineSink(const std::string& path, Options options);
+
+    void write(const LogRecord& record) override;
+private:
+    void putTime(std::chrono::system_clock::time_point time);
+
+    std::string mLine;
+    // "YYYY-MM-DDTHH:MM:SS" of the last formatted second
+    int64_t mSecond = -1;
+    char mSecondText[20] = {};
+};
@@ -0,0 +1,201 @@
+//
+// Core: LogFormat.h
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "Config.h"
+#include "Logger.h"
+#include <array>
+#include <tuple>
+#include <cstddef>
+#include <charconv>
+#include <utility>
+#include <string_view>
+#include <type_traits>
+
+/*
+ * Format-string logging: `infolog("chunk {} loaded in {}ms", id, ms);`
+ * `{}` is replaced by the next argument as `<<` would print it, `{x}` by the next integer in hexadecimal, and
+ * `{{` / `}}` stand for single braces (the same syntax as BinaryLog and the LogDecoder).
+ * The format string is split into literal and argument segments at compile time, and a malformed string or
+ * a placeholder count different from the argument count fails to compile. Each call then appends the
+ * segments in order, unrolled, without looking at the format string again.
+ */
+namespace LogFormat {
+    struct Segment {
+        size_t begin = 0, size = 0; // Literal text within the format string
+        int arg = -1;               // Argument index, -1 for a literal
+        bool hex = false;
+    };
+
+    namespace Details {
+        // Number of segments, or -1 if the format string is malformed
+        constexpr int segmentCount(std::string_view format) noexcept {
+            int count = 0;
+            bool literal = false;
+            for (size_t i = 0; i < format.size(); ++i) {
+                const auto c = format[i];
+                const auto next = i + 1 < format.size() ? format[i + 1] : '\0';
+                if (c == '{' && next == '}') {
+                    ++count, ++i, literal = false;
+                }
+                else if (c == '{' && next == 'x' && i + 2 < format.size() && format[i + 2] == '}') {
+                    ++count, i += 2, literal = false;
+                }
+                else if ((c == '{' || c == '}') && next != c) {
+                    return -1;
+                }
+                else {
+                    if (c == '{' || c == '}')
+                        ++i;
+                    // An escaped brace ends its literal segment, since only one of the two characters is printed
+                    if (!literal)
+                        ++count;
+                    literal = c != '{' && c != '}';
+                }
+            }
+            return count;
+        }
+
+        template <size_t count>
+        constexpr std::array<Segment, count> segments(std::string_view format) noexcept {
+            std::array<Segment, count> ret{};
+            size_t n = 0;
+            int arg = 0;
+            bool literal = false;
+            for (size_t i = 0; i < format.size(); ++i) {
+                const auto c = format[i];
+                const auto next = i + 1 < format.size() ? format[i + 1] : '\0';
+                if (c == '{' && (next == '}' || next == 'x')) {
+                    ret[n].arg = arg++;
+                    ret[n++].hex = next == 'x';
+                    i += next == 'x' ? 2 : 1;
+                    literal = false;
+                }
+                else {
+                    if (!literal)
+                        ret[n++].begin = i;
+                    ++ret[n - 1].size;
+                    if (c == '{' || c == '}')
+                        ++i;
+                    literal = c != '{' && c != '}';
+                }
+            }
+            return ret;
+        }
+
+        template <class Format>
+        constexpr int count = segmentCount(Format::get());
+
+        template <class Format>
+        constexpr auto parse() noexcept {
+            if constexpr (count<Format> < 0)
+                return std::array<Segment, 0>();
+            else
+                return segments<static_cast<size_t>(count<Format>)>(Format::get());
+        }
+
+        template <class Format>
+        constexpr auto parsed = parse<Format>();
+
+        template <class Format>
+        constexpr int placeholders() noexcept {
+            int ret = 0;
+            for (auto& segment : parsed<Format>)
+                ret += segment.arg >= 0;
+            return ret;
+        }
+
+        template <class Format, class... Args>
+        constexpr bool hexArgumentsIntegral() noexcept {
+            constexpr bool integral[sizeof...(Args) + 1] = {
+                    (std::is_integral_v<Args> && !std::is_same_v<Args, bool>)..., true};
+            for (auto& segment : parsed<Format>)
+                if (segment.hex && segment.arg < static_cast<int>(sizeof...(Args)) && !integral[segment.arg])
+                    return false;
+            return true;
+        }
+
+        template <class Format, size_t index, class Tuple>
+        void put(Logger& logger, const Tuple& args) {
+            constexpr auto segment = parsed<Format>[index];
+            if constexpr (segment.arg < 0)
+                logger << Format::get().substr(segment.begin, segment.size);
+            else if constexpr (segment.hex) {
+                const auto value = std::get<segment.arg>(args);
+                char buffer[24];
+                const auto end = std::to_chars(buffer, buffer + sizeof(buffer),
+                                               static_cast<std::make_unsigned_t<std::decay_t<decltype(value)>>>(value),
+                                               16).ptr;
+                logger << std::string_view(buffer, static_cast<size_t>(end - buffer));
+            }
+            else
+                logger << std::get<segment.arg>(args);
+        }
+
+        template <class Format, class Tuple, size_t... indices>
+        void write(Logger& logger, const Tuple& args, std::index_sequence<indices...>) {
+            (put<Format, indices>(logger, args), ...);
+        }
+    }
+
+    /**
+     * \brief Append the formatted message to a record. `Format::get()` returns the format string and must be
+     *        constexpr; the first argument is the same string again and is ignored (see `loggerformat`)
+     */
+    template <class Format, class... Args>
+    void write(Logger& logger, std::string_view, const Args&... args) {
+        constexpr bool wellFormed = Details::count<Format> >= 0;
+        constexpr bool argumentsMatch = Details::placeholders<Format>() == sizeof...(Args);
+        constexpr bool hexIntegral = Details::hexArgumentsIntegral<Format, Args...>();
+        static_assert(wellFormed, "Malformed log format string, write braces as {{ and }}");
+        static_assert(argumentsMatch, "Log format string placeholders do not match the number of arguments");
+        static_assert(hexIntegral, "{x} requires an integer argument");
+        if constexpr (wellFormed && argumentsMatch && hexIntegral)
+            Details::write<Format>(logger, std::forward_as_tuple(args...),
+                                   std::make_index_sequence<Details::parsed<Format>.size()>());
+    }
+}
+
+#define NW_LOG_EXPAND(x) x
+#define NW_LOG_FIRST(first, ...) first
+// Subject to the same compile-time and runtime level gates as `loggerstream`. The format string is the first of
+// the variadic arguments, so that a message without placeholders needs no trailing argument
+#define loggerformat(level, ...) \
+    do { \
+        if constexpr (static_cast<int>(Logger::Level::level) >= NW_MIN_LOG_LEVEL) { \
+            if (Logger::enabled(Logger::Level::level, nwLogComponent)) { \
+                struct NWLogFormat { \
+                    static constexpr std::string_view get() noexcept { \
+                        return NW_LOG_EXPAND(NW_LOG_FIRST(__VA_ARGS__, 0)); \
+                    } \
+                }; \
+                Logger NWLogger(__FILE__, __FUNCTION__, __LINE__, Logger::Level::level, NW_COMPONENT_NAME, \
+                                nwLogComponent); \
+                LogFormat::write<NWLogFormat>(NWLogger, __VA_ARGS__); \
+            } \
+        } \
+    } while (false)
+// Format-string counterparts of the stream macros. Usage: `infolog("chunk {} loaded in {}ms", id, ms);`
+#define verboselog(...) loggerformat(verbose, __VA_ARGS__)
+#define debuglog(...) loggerformat(debug, __VA_ARGS__)
+#define infolog(...) loggerformat(info, __VA_ARGS__)
+#define warninglog(...) loggerformat(warning, __VA_ARGS__)
+#define errorlog(...) loggerformat(error, __VA_ARGS__)
+#define fatallog(...) loggerformat(fatal, __VA_ARGS__)
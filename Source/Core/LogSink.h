@@ -0,0 +1,90 @@
+//
+// Core: LogSink.h
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include "Config.h"
+#include "Logger.h"
+#include "Utility.h"
+
+struct LogRecord {
+    Logger::Level level;
+    // Plain (uncolored) text of the record, ending with a line break
+    std::string_view text;
+    // NW_COMPONENT_NAME of the module that logged the record
+    std::string_view component;
+    // Id of the logging thread as known to the operating system
+    uint64_t thread;
+    std::chrono::system_clock::time_point time;
+    // Plain message, without the prefix, the fields and the source location
+    std::string_view message;
+    // Fields attached with Logger::kv as JSON members `"key":value,...`, empty if there are none
+    std::string_view fields;
+};
+
+/**
+ * \brief Write `text` as the contents of a JSON string, passing the pieces to `put(const char*, size_t)`
+ */
+template <class Put>
+void escapeJson(std::string_view text, Put&& put) {
+    size_t done = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        const auto ch = static_cast<unsigned char>(text[i]);
+        if (ch >= 0x20 && ch != '"' && ch != '\\')
+            continue;
+        put(text.data() + done, i - done);
+        done = i + 1;
+        char escaped[6] = {'\\', static_cast<char>(ch), '0', '0', "0123456789abcdef"[ch >> 4], "0123456789abcdef"[ch & 15]};
+        size_t length = 2;
+        switch (ch) {
+        case '\n': escaped[1] = 'n'; break;
+        case '\r': escaped[1] = 'r'; break;
+        case '\t': escaped[1] = 't'; break;
+        case '"': case '\\': break;
+        default:
+            escaped[1] = 'u';
+            length = 6;
+        }
+        put(escaped, length);
+    }
+    put(text.data() + done, text.size() - done);
+}
+
+/**
+ * \brief A destination for finished records, registered through Logger::addSink.
+ *        All calls are serialized by the Logger, either on the logging thread or on the asynchronous writer thread
+ */
+class NWCOREAPI LogSink : public NonCopyableVirtualBase {
+public:
+    virtual void write(const LogRecord& record) = 0;
+
+    /**
+     * \brief Push everything written so far out of any internal buffer. Called by Logger::flush
+     */
+    virtual void flush() {}
+
+    /**
+     * \brief Called by the asynchronous writer thread when there is nothing to write, at least every 100ms, and
+     *        after a synchronous write at most every 100ms. Lets buffering sinks honor time-based thresholds
+     */
+    virtual void idle() {}
+};
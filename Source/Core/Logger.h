@@ -21,12 +21,26 @@
 
 #include "Config.h"
 #include <sstream>
+#include <ostream>
+#include <charconv>
 #include <mutex>
 #include <vector>
 #include <string>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+// Statements below this level (0 = verbose ... 5 = fatal) are compiled out entirely
+#ifndef NW_MIN_LOG_LEVEL
+#define NW_MIN_LOG_LEVEL 0
+#endif
 
 class LoggerManager;
+class LogSink;
 
 class NWCOREAPI Logger {
 public:
@@ -39,11 +53,113 @@ public:
         fatal
     };
 
-    Logger(const char* fileName, const char* funcName, int lineNumber, Level level, const char* mgr);
+    // What the asynchronous backend does with a record when its queue is full
+    enum class Overflow {
+        block,          // Wait until the writer thread frees a slot
+        dropNewest,     // Discard the record being logged
+        overwriteOldest // Discard the oldest queued record to make room
+    };
+
+    /**
+     * \brief Call site state of `loggerlimited`. A token bucket (kept as a theoretical arrival time, so one CAS
+     *        refills and takes a token) lets `burst` records through at once and `perSecond` after that; a record
+     *        repeating the previous message of the site within `window` is dropped as a duplicate.
+     *        Dropped records are counted and reported as one summary record per site
+     */
+    class NWCOREAPI RateLimit {
+    public:
+        constexpr explicit RateLimit(uint32_t perSecond = 10, uint32_t burst = 20) noexcept
+                : mInterval(1000000000ull / (perSecond ? perSecond : 1)),
+                  mTolerance((burst ? burst - 1 : 0) * (1000000000ull / (perSecond ? perSecond : 1))) {}
+
+        // Takes a token; lock-free, and the record is not even formatted when this fails
+        bool admit() noexcept {
+            const auto now = clock();
+            auto arrival = mArrival.load(std::memory_order_relaxed);
+            for (;;) {
+                const auto base = arrival > now ? arrival : now;
+                if (base - now > mTolerance) {
+                    suppress();
+                    return false;
+                }
+                if (mArrival.compare_exchange_weak(arrival, base + mInterval, std::memory_order_relaxed))
+                    return true;
+            }
+        }
+
+        static constexpr std::chrono::seconds window{5};
+    private:
+        friend class Logger;
+        struct Summary;
+
+        static uint64_t clock() noexcept {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        void suppress() noexcept;
+        void describe(const char* file, const char* func, int line, Level level, const char* component,
+                      int componentId);
+        // Whether the message is the same as the previous one of the site, within `window`
+        bool repeated(uint64_t hash, uint64_t now) noexcept;
+
+        uint64_t mInterval, mTolerance;
+        std::atomic<uint64_t> mArrival{0};
+        std::atomic<uint64_t> mLastHash{0}, mLastEmitted{0};
+        // Created by the first record of the site and owned by Core, so that the summaries do not depend on the
+        // module holding this site staying loaded
+        std::atomic<Summary*> mSummary{nullptr};
+    };
+
+    // Components past this many share id 0, which only follows the global levels
+    static constexpr size_t maxComponents = 64;
+
+    Logger(const char* fileName, const char* funcName, int lineNumber, Level level, const char* mgr,
+           int component = 0, RateLimit* limit = nullptr);
     ~Logger();
 
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    // Characters, strings and numbers are appended to the buffer directly while the stream has its default
+    // formatting (numbers as with `%g` / `%d`); everything else goes through the stream
     template <typename T>
     Logger& operator<<(const T& rhs) {
+        if constexpr (std::is_same_v<T, char>) {
+            if (!mContent.width()) {
+                mText.push_back(rhs);
+                return *this;
+            }
+        }
+        else if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, signed char> &&
+                           !std::is_same_v<T, unsigned char> && !std::is_same_v<T, wchar_t> &&
+                           !std::is_same_v<T, char16_t> && !std::is_same_v<T, char32_t>) {
+            if (plainStream()) {
+                char buffer[24];
+                mText.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), rhs).ptr);
+                return *this;
+            }
+        }
+        else if constexpr (std::is_floating_point_v<T>) {
+            if (plainStream()) {
+                char buffer[64];
+                const auto result = std::to_chars(buffer, buffer + sizeof(buffer), rhs, std::chars_format::general,
+                                                  static_cast<int>(mContent.precision()));
+                if (result.ec == std::errc()) {
+                    mText.append(buffer, result.ptr);
+                    return *this;
+                }
+            }
+        }
+        else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+            bool valid = !mContent.width();
+            if constexpr (std::is_pointer_v<T>)
+                valid = valid && rhs;
+            if (valid) {
+                mText.append(std::string_view(rhs));
+                return *this;
+            }
+        }
         mContent << rhs;
         return *this;
     }
@@ -55,28 +171,249 @@ public:
         return *this;
     }
 
+    /**
+     * \brief Attach a structured field to the record, e.g. `infostream.kv("chunk", id) << "Chunk loaded"`.
+     *        Sinks receive the fields as JSON members; the text output gets them appended as ` key=value`.
+     *        Fields are encoded into a fixed buffer in the Logger, the ones that do not fit are dropped
+     */
+    template <typename T>
+    Logger& kv(std::string_view key, const T& value) {
+        if constexpr (std::is_enum_v<T>)
+            return kv(key, static_cast<std::underlying_type_t<T>>(value));
+        else if constexpr (std::is_same_v<T, bool>)
+            addField(key, value);
+        else if constexpr (std::is_same_v<T, char>)
+            addField(key, std::string_view(&value, 1));
+        else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+            addField(key, static_cast<int64_t>(value));
+        else if constexpr (std::is_integral_v<T>)
+            addField(key, static_cast<uint64_t>(value));
+        else if constexpr (std::is_floating_point_v<T>)
+            addField(key, static_cast<double>(value));
+        else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+            if constexpr (std::is_pointer_v<T>)
+                addField(key, value ? std::string_view(value) : std::string_view("(null)"));
+            else
+                addField(key, std::string_view(value));
+        }
+        else {
+            // Anything else is stored as the string its operator<< produces
+            std::ostringstream text;
+            text << value;
+            addField(key, std::string_view(text.str()));
+        }
+        return *this;
+    }
+
+    /**
+     * \brief Add a FileSink writing to `path` + `prefix` + "_" + startup time + ".log", rotated daily and at 64MB,
+     *        keeping the last 16 rotated files
+     */
     static void addFileSink(const std::string& path, const std::string& prefix);
+
+    /**
+     * \brief Add a sink receiving every record at or above the file level
+     * \return The sink, which stays owned by the Logger
+     */
+    static LogSink* addSink(std::unique_ptr<LogSink> sink);
+
+    /**
+     * \brief Detach a sink added with addSink. Records logged before the call are written to it first
+     * \return The sink, flushed, or nullptr if it was not attached
+     */
+    static std::unique_ptr<LogSink> removeSink(LogSink* sink);
+
+    /**
+     * \brief Set the levels from which records are printed to the console, redirected to stderr,
+     *        written to the file sinks, and annotated with their source location
+     */
+    static void setLevels(Level cout, Level cerr, Level file, Level line);
+
+    /**
+     * \brief Check whether a record of the given level would be written anywhere.
+     *        Used by `loggerstream` to skip the whole statement, including its operands
+     */
+    static bool enabled(Level level) noexcept {
+        return static_cast<int>(level) >= gate.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Check whether a record of the given level from the given component would be written anywhere
+     */
+    static bool enabled(Level level, int component) noexcept {
+        return static_cast<int>(level) >= componentGates[component].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Log a summary for every `loggerlimited` site that dropped records and has been quiet for
+     *        RateLimit::window, or for every such site if `all` is set. Called by flush; the asynchronous writer
+     *        reports the quiet sites itself
+     */
+    static void reportSuppressed(bool all);
+
+    /**
+     * \brief Intern a component name (the `mgr` / NW_COMPONENT_NAME of a module) to a small id
+     */
+    static int componentId(const char* name);
+
+    /**
+     * \brief Print and write records of one component from `level` on, regardless of the console and file levels.
+     *        Redirection to stderr and source locations still follow the global levels
+     */
+    static void setComponentLevel(const std::string& component, Level level);
+
+    /**
+     * \brief Let a component follow the global levels again
+     */
+    static void clearComponentLevel(const std::string& component);
+
+    /**
+     * \brief Apply the component levels in the settings (`"Logger": {"Levels": {"World": "debug"}}`) and register
+     *        `bool setLogLevel(const std::string& component, const std::string& level)` on the eventBus, so that
+     *        a console command can change them later. The level "default" clears the override
+     */
+    static void loadLevels();
+
+    // Turns a `loggerstream` chain into a void expression
+    struct Voidify {
+        void operator&(const Logger&) const noexcept {}
+    };
+
+    /**
+     * \brief Hand records over to a background writer thread instead of writing them on the logging thread
+     * \param capacity Number of records the queue can hold, rounded up to a power of two
+     * \param policy What to do with a record when the queue is full
+     */
+    static void enableAsync(size_t capacity = 8192, Overflow policy = Overflow::block);
+
+    /**
+     * \brief Write out every queued record, stop the writer thread and go back to synchronous logging
+     */
+    static void disableAsync();
+
+    /**
+     * \brief Block until every record queued so far has been written, then flush every sink
+     */
+    static void flush();
+
+    /**
+     * \brief Number of records discarded by the asynchronous backend because its queue was full
+     */
+    static uint64_t droppedCount() noexcept;
 private:
+    friend class LoggerBackend;
+    friend class FlightRecorder;
+
+    // Everything about a finished record besides its text, as handed to writeRecord
+    struct RecordInfo {
+        const char* component;
+        int componentId;
+        uint64_t thread;
+        std::chrono::system_clock::time_point time;
+        // The message inside the text, without the prefix and the source location
+        size_t messageBegin, messageEnd;
+        std::string_view fields;
+    };
+
+    static constexpr size_t fieldBytes = 512, maxFields = 16;
+
     Level mLevel;
     int mLineNumber;
     const char* mFileName;
     const char* mFuncName;
-    bool fileOnly{false};
-    std::stringstream mContent;
-    std::lock_guard<std::mutex> mLock;
+    const char* mComponent;
+    int mComponentId;
+    RateLimit* mLimit;
+    // Written to the sinks by the calling thread even in asynchronous mode, for records of the writer thread
+    bool mDirect = false;
+    std::chrono::system_clock::time_point mTime;
+    size_t mMessageBegin;
+    // A stream and its buffer borrowed from the thread for the lifetime of the Logger; both are reused
+    std::ostream& mContent;
+    std::string& mText;
+    // JSON members `"key":value,...`; the offsets mark where each key and value starts
+    std::array<char, fieldBytes> mFields;
+    uint16_t mFieldsSize = 0, mFieldCount = 0;
+    std::array<uint16_t, maxFields> mKeyBegin, mValueBegin;
 
     static Level coutLevel;
     static Level cerrLevel;
     static Level fileLevel;
     static Level lineLevel;
     static std::mutex mutex;
-    static std::vector<std::ofstream> fsink;
+    static std::vector<std::unique_ptr<LogSink>> sinks;
     static std::array<const char*, 6> levelTags;
+    // The lowest level that passes any of the component gates
+    static std::atomic_int gate;
+    // Per component id: the lowest level that reaches any output or the FlightRecorder
+    static std::array<std::atomic_int, maxComponents> componentGates;
+    // Per component id: the lowest level written to the console or the sinks
+    static std::array<std::atomic_int, maxComponents> componentOutputs;
+    // Per component id: 1 + the level set with setComponentLevel, 0 if there is none
+    static std::array<int, maxComponents> componentLevels;
+    // Every `loggerlimited` site that logged anything, never removed
+    static std::atomic<RateLimit::Summary*> limitedSites;
+
+    static void updateGate();
+
+    bool plainStream() const noexcept {
+        constexpr auto formatting = std::ios_base::basefield | std::ios_base::floatfield | std::ios_base::showpos |
+                                    std::ios_base::showpoint | std::ios_base::showbase | std::ios_base::uppercase;
+        return (mContent.flags() & formatting) == std::ios_base::dec && !mContent.width();
+    }
+
+    void finish();
+    static Level consoleLevel(int component) noexcept;
+    static Level sinkLevel(int component) noexcept;
 
-    void writeOstream(std::ostream& ostream, bool noColor = false) const;
+    void addField(std::string_view key, bool value);
+    void addField(std::string_view key, int64_t value);
+    void addField(std::string_view key, uint64_t value);
+    void addField(std::string_view key, double value);
+    void addField(std::string_view key, std::string_view value);
+    void putField(std::string_view key, std::string_view value, bool quoted);
+
+    static void reportSuppressed(bool all, bool direct);
+    static void summarize(const RateLimit::Summary& site, uint64_t count, uint64_t elapsed, bool direct);
+
+    // Returns whether the record went to the sinks
+    static bool writeRecord(Level level, const std::string& content, const RecordInfo& info);
+    static void writeOstream(std::ostream& ostream, const std::string& str);
 };
 
-#define loggerstream(level) Logger(__FILE__, __FUNCTION__, __LINE__, Logger::Level::level, NW_COMPONENT_NAME)
+#ifdef NW_COMPONENT_NAME
+namespace {
+    // The component of this module, interned once per translation unit. Statements running before it is
+    // initialized use id 0
+    const int nwLogComponent = Logger::componentId(NW_COMPONENT_NAME);
+}
+#endif
+
+// Disabled statements cost one relaxed load and a branch, their `<<` operands are not evaluated. The conditional
+// expression (rather than an if-else) keeps a trailing `else` in user code bound to the user's `if`; `&` binds
+// looser than `<<` so the whole chain is built before it is discarded
+#define loggerstream(level) \
+    (static_cast<int>(Logger::Level::level) < NW_MIN_LOG_LEVEL || \
+     !Logger::enabled(Logger::Level::level, nwLogComponent)) ? (void)0 : Logger::Voidify() & \
+    Logger(__FILE__, __FUNCTION__, __LINE__, Logger::Level::level, NW_COMPONENT_NAME, nwLogComponent)
+#ifdef NW_COMPONENT_NAME
+namespace {
+    // One RateLimit per `loggerlimited` line of a translation unit
+    template <int line>
+    Logger::RateLimit& nwLogLimit() noexcept {
+        static Logger::RateLimit site;
+        return site;
+    }
+}
+#endif
+
+// Like loggerstream, but rate limited per call site and collapsing repeated messages (see Logger::RateLimit).
+// A dropped record costs the level check plus one CAS, and is not formatted. At most one per line
+#define loggerlimited(level) \
+    (static_cast<int>(Logger::Level::level) < NW_MIN_LOG_LEVEL || \
+     !Logger::enabled(Logger::Level::level, nwLogComponent) || !nwLogLimit<__LINE__>().admit()) ? (void)0 : \
+    Logger::Voidify() & Logger(__FILE__, __FUNCTION__, __LINE__, Logger::Level::level, NW_COMPONENT_NAME, \
+                               nwLogComponent, &nwLogLimit<__LINE__>())
 // Information for tracing
 #define verbosestream loggerstream(verbose)
 // Information for developers
@@ -89,3 +426,9 @@ private:
 #define errorstream loggerstream(error)
 // Unrecoverable error and program termination is required
 #define fatalstream loggerstream(fatal)
+// Rate limited versions, for statements that may run in a hot loop
+#define verboselimited loggerlimited(verbose)
+#define debuglimited loggerlimited(debug)
+#define infolimited loggerlimited(info)
+#define warninglimited loggerlimited(warning)
+#define errorlimited loggerlimited(error)
@@ -0,0 +1,106 @@
+//
+// Core: Mailbox.h
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include "Config.h"
+
+/**
+ * \brief Tasks posted from any thread, run by the thread that owns the mailbox when it calls drain().
+ *        Posting is lock-free: an intrusive multi-producer single-consumer queue with one exchange per post.
+ *        Tasks run in the order they were posted by each thread; ones still queued on destruction are dropped
+ */
+class NWCOREAPI Mailbox {
+public:
+    /**
+     * \brief The queue behind a mailbox. The mailbox holds the only lasting reference to it; anything that posts
+     *        from elsewhere keeps a weak one, which expires with the mailbox, and locks it for each post
+     */
+    class NWCOREAPI Queue {
+    public:
+        Queue() noexcept;
+
+        Queue(const Queue&) = delete;
+
+        Queue& operator=(const Queue&) = delete;
+
+        ~Queue();
+
+        bool isOwner() const noexcept { return std::this_thread::get_id() == mOwner; }
+
+        void bind() noexcept { mOwner = std::this_thread::get_id(); }
+
+        template <class Func>
+        void post(Func&& fn) { push(new Task<std::decay_t<Func>>(std::forward<Func>(fn))); }
+
+        size_t drain();
+    private:
+        struct Node {
+            virtual ~Node() noexcept = default;
+            virtual void run() {}
+            std::atomic<Node*> next{nullptr};
+        };
+
+        template <class Func>
+        struct Task : Node {
+            explicit Task(Func&& fn) : fc(std::move(fn)) {}
+            explicit Task(const Func& fn) : fc(fn) {}
+            void run() override { fc(); }
+            Func fc;
+        };
+
+        void push(Node* node) noexcept;
+        Node* pop() noexcept;
+
+        std::thread::id mOwner;
+        // Producers swap themselves in at the head, the owner takes tasks off the tail; the stub keeps it non-empty
+        alignas(64) std::atomic<Node*> mHead;
+        alignas(64) Node* mTail;
+        Node mStub;
+    };
+
+    // Owned by the constructing thread
+    Mailbox() : mQueue(std::make_shared<Queue>()) {}
+
+    Mailbox(const Mailbox&) = delete;
+
+    Mailbox& operator=(const Mailbox&) = delete;
+
+    bool isOwner() const noexcept { return mQueue->isOwner(); }
+
+    // Makes the calling thread the owner, for a mailbox created before the thread it belongs to
+    void bind() noexcept { mQueue->bind(); }
+
+    template <class Func>
+    void post(Func&& fn) { mQueue->post(std::forward<Func>(fn)); }
+
+    // Runs the tasks queued when it is called on the owner thread and returns how many ran. Tasks posted in the
+    // meantime, including by the ones running, wait for the next drain. A task that throws is lost, the others
+    // stay queued for the next drain
+    size_t drain() { return mQueue->drain(); }
+
+    // For posting from something that may outlive the mailbox
+    std::weak_ptr<Queue> queue() const noexcept { return mQueue; }
+private:
+    std::shared_ptr<Queue> mQueue;
+};
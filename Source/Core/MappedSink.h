@@ -0,0 +1,78 @@
+//
+// Core: MappedSink.h
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "LogSink.h"
+
+/**
+ * \brief Writes records into preallocated, memory-mapped log segments.
+ *        A write reserves its range with one atomic add and copies the record in; there is no system call per
+ *        record, and everything copied survives a crash of the process through the page cache.
+ *        When a segment is full the sink rolls over to `prefix_<time>.<n>.log`. The unused, zero-filled tail of
+ *        the last segment is trimmed on destruction; after a crash it is left in place.
+ *        If the next segment cannot be created (a full disk, say), records are dropped and counted until a retry
+ *        succeeds; retries happen on writes at most once a second.
+ * \note  Only available on POSIX systems, the constructor throws elsewhere
+ */
+class NWCOREAPI MappedSink : public LogSink {
+public:
+    MappedSink(const std::string& path, const std::string& prefix, size_t segmentBytes = 16u << 20u);
+
+    ~MappedSink() override;
+
+    void write(const LogRecord& record) override;
+
+    void flush() override;
+
+    // Segment files opened so far
+    size_t segmentCount() const noexcept;
+
+    // Records dropped because no segment could be opened
+    uint64_t lost() const noexcept { return mLost.load(std::memory_order_relaxed); }
+private:
+    struct Segment;
+
+    bool roll(Segment* full);
+    bool open();
+    void close(Segment* seg);
+
+    std::string mBaseName;
+    size_t mSegmentBytes;
+    std::atomic<Segment*> mCurrent{nullptr};
+    // Closed segments are unmapped and kept for reuse rather than freed, as a writer may still hold a pointer to
+    // one and only touches its counters to find it is no longer current. The current one and the one being
+    // closed are all that is ever allocated
+    std::vector<std::unique_ptr<Segment>> mSegments;
+    std::vector<Segment*> mSpare;
+    // Current while no segment could be opened: it has no room, so every write goes on to roll()
+    std::unique_ptr<Segment> mBroken;
+    size_t mOpened = 0;
+    // Guarded by mRoll: when to try opening a segment again, and whether the failure was reported yet
+    std::chrono::steady_clock::time_point mRetry;
+    bool mFailed = false;
+    std::atomic<uint64_t> mLost{0};
+    mutable std::mutex mRoll;
+};
@@ -0,0 +1,63 @@
+//
+// Core: Span.h
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <cstddef>
+
+#if __cplusplus > 201703L && __has_include(<span>)
+#include <span>
+
+template <class T>
+using Span = std::span<T>;
+#else
+
+/**
+ * \brief A view of a contiguous array, the subset of std::span that is used here until C++20 is required
+ */
+template <class T>
+class Span {
+public:
+    using element_type = T;
+    using iterator = T*;
+
+    constexpr Span() noexcept = default;
+
+    constexpr Span(T* data, size_t size) noexcept : mData(data), mSize(size) {}
+
+    constexpr T* data() const noexcept { return mData; }
+
+    constexpr size_t size() const noexcept { return mSize; }
+
+    constexpr bool empty() const noexcept { return !mSize; }
+
+    constexpr T& operator[](size_t index) const noexcept { return mData[index]; }
+
+    constexpr T& front() const noexcept { return mData[0]; }
+
+    constexpr T& back() const noexcept { return mData[mSize - 1]; }
+
+    constexpr T* begin() const noexcept { return mData; }
+
+    constexpr T* end() const noexcept { return mData + mSize; }
+private:
+    T* mData = nullptr;
+    size_t mSize = 0;
+};
+#endif
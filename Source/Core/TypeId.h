@@ -0,0 +1,36 @@
+//
+// Core: TypeId.h
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <typeinfo>
+#include "Config.h"
+
+// Returns the id of a type, handing out the next one if it is new. Ids count up from 0 and are shared by all
+// modules, as they are looked up by the type_info in Core rather than by a counter in each module
+NWCOREAPI size_t registerTypeId(const std::type_info& type);
+
+// A small integer identifying T for the lifetime of the process, meant to index tables; only the first call of
+// each module takes a lock
+template <class T>
+size_t typeId() {
+    static const size_t id = registerTypeId(typeid(T));
+    return id;
+}
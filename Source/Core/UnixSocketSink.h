@@ -0,0 +1,92 @@
+//
+// Core: UnixSocketSink.h
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include "LogSink.h"
+
+/**
+ * \brief Streams records to a local collector listening on a Unix domain stream socket.
+ *        Every record is one frame: a big-endian u32 length, then the level as one byte and the plain text.
+ *        Frames are batched and sent with non-blocking calls only; while the collector is unreachable or slow
+ *        they wait in a bounded spill buffer, which drops the oldest frames when full, and the connection is
+ *        retried with a growing delay. A frame cut off by a lost connection is sent again whole.
+ * \note  Only available on POSIX systems, the constructor throws elsewhere
+ */
+class NWCOREAPI UnixSocketSink : public LogSink {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        // Send once this many bytes are buffered
+        size_t batchBytes = 16 * 1024;
+        // Send once the oldest buffered frame is this old
+        std::chrono::milliseconds flushInterval{100};
+        // Records at or above this level are sent immediately
+        Logger::Level flushLevel = Logger::Level::error;
+        // Frames kept while the collector is away; the oldest ones are dropped beyond this
+        size_t spillBytes = 4u << 20u;
+        // Delay before the first reconnection attempt, doubled after each failure up to the maximum
+        std::chrono::milliseconds reconnectMin{100}, reconnectMax{5000};
+    };
+
+    struct Stats {
+        uint64_t frames, bytes, dropped, connects;
+        bool connected;
+    };
+
+    explicit UnixSocketSink(const std::string& path);
+
+    UnixSocketSink(const std::string& path, Options options);
+
+    ~UnixSocketSink() override;
+
+    void write(const LogRecord& record) override;
+
+    // Sends what the socket takes without blocking, the rest stays buffered
+    void flush() override;
+
+    void idle() override;
+
+    Stats stats() const noexcept;
+private:
+    void send();
+    bool connect();
+    void disconnect();
+    // Drops whole frames from the front, after the one partly sent, until `incoming` more bytes fit into the spill
+    // buffer. Returns false if the incoming frame has to be dropped instead
+    bool spill(size_t incoming);
+    // Removes the frames that were sent completely
+    void consume();
+
+    std::string mPath;
+    Options mOptions;
+    // Written by the logging side only, atomic so that stats() can be called from anywhere
+    std::atomic<int> mSocket{-1};
+    // Frames waiting to be sent, starting at mBegin; the first mSent bytes of them are on the wire already
+    std::string mBuffer;
+    size_t mBegin = 0, mSent = 0;
+    Clock::time_point mOldest, mRetryAt;
+    std::chrono::milliseconds mRetryDelay;
+    std::atomic<uint64_t> mFrames{0}, mBytes{0}, mDropped{0}, mConnects{0};
+};
@@ -0,0 +1,67 @@
+//
+// Core: WorkerPool.h
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include "Config.h"
+
+/**
+ * \brief A fixed set of threads running posted tasks in FIFO order.
+ *        Tasks must not throw; parallelFor collects the exceptions of its own iterations
+ */
+class NWCOREAPI WorkerPool {
+public:
+    // 0 threads picks one less than the hardware threads, as the caller usually takes part in the work
+    explicit WorkerPool(size_t threads = 0);
+
+    WorkerPool(const WorkerPool&) = delete;
+
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Runs the tasks still queued, then joins the threads
+    ~WorkerPool();
+
+    size_t size() const noexcept { return mThreads.size(); }
+
+    void post(std::function<void()> task);
+
+    /**
+     * \brief Calls fn(i) for every i in [0, count) on the workers and the calling thread, and returns when all
+     *        calls are done. Safe to call from a worker, which then does the work itself if the others are busy
+     * \note  Rethrows the first exception thrown by fn once all calls are done
+     */
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+    // A pool with the default size, created on first use
+    static WorkerPool& shared();
+private:
+    void run();
+
+    std::vector<std::thread> mThreads;
+    std::deque<std::function<void()>> mTasks;
+    std::mutex mLock;
+    std::condition_variable mWake;
+    bool mExit = false;
+};
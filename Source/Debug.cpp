@@ -19,6 +19,7 @@
 
 #include "Core/Debug.h"
 #include "Core/Logger.h"
+#include "Core/FlightRecorder.h"
 #include <boost/stacktrace.hpp>
 #include <iostream>
 
@@ -28,6 +29,7 @@ void assertFunc(bool expr, const char* file, const char* fname, int line) {
         fatalstream << "Assertion failed!\nAt line " << line
             << " in \"" << file << "\", function " << fname;
         infostream << "Backtrace:\n" << stacktrace;
+        FlightRecorder::dump("assertion failed");
         throw std::runtime_error("Assertion failed!");
     }
 }
@@ -0,0 +1,56 @@
+//
+// Core: Delegate.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <mutex>
+#include <typeindex>
+#include <unordered_map>
+#include "Core/Delegate.h"
+
+namespace {
+    std::mutex& staticLock() {
+        static std::mutex lock;
+        return lock;
+    }
+}
+
+namespace __Details {
+    StaticTable& staticTable(const std::type_info& signal) {
+        // Never destroyed, for emissions during static destruction
+        static auto& tables = *new std::unordered_map<std::type_index, StaticTable>();
+        std::lock_guard<std::mutex> lk(staticLock());
+        return tables[signal];
+    }
+
+    void staticConnect(StaticTable& table, void (*fn)(), int priority) {
+        std::lock_guard<std::mutex> lk(staticLock());
+        if (table.Size == table.Capacity) {
+            const auto capacity = table.Capacity ? table.Capacity * 2 : 8;
+            auto entries = std::make_unique<StaticTable::Entry[]>(capacity);
+            std::copy(table.Entries, table.Entries + table.Size, entries.get());
+            delete[] table.Entries;
+            table.Entries = entries.release();
+            table.Capacity = capacity;
+        }
+        auto pos = table.Size;
+        for (; pos && table.Entries[pos - 1].Priority < priority; --pos)
+            table.Entries[pos] = table.Entries[pos - 1];
+        table.Entries[pos] = {fn, priority};
+        ++table.Size;
+    }
+}
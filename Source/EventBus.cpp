@@ -30,14 +30,14 @@ void EventBus::registerImpl(const std::string &funcName, FunctionPointer func, c
     auto& list = getSubscribers(funcName, typeId);
     list.emplace_back(func);
     if (list.size() != 1)
-        warningstream << "Multiple(" << list.size() << ") functions with name" << funcName << " and type " <<
+        warninglimited << "Multiple(" << list.size() << ") functions with name" << funcName << " and type " <<
                       typeId.name() << " (hash: " << typeId.hash_code() << ") registered.";
 }
 
 EventBus::FunctionPointer EventBus::callGet(const std::string &funcName, const std::type_info &typeId) {
     auto& list = getSubscribers(funcName, typeId);
     if (list.size() == 0) {
-        warningstream << "Failed to call function " << funcName
+        warninglimited << "Failed to call function " << funcName
                       << " with type " << typeId.name() << " (hash: " << typeId.hash_code() << "): "
                       << (list.empty()
                           ? "No such function registered"
@@ -0,0 +1,476 @@
+//
+// Core: FileSink.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <deque>
+#include <mutex>
+#include <cerrno>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/predef/os.h>
+#include <condition_variable>
+#include "Core/FileSink.h"
+#include "Core/Filesystem.h"
+
+#ifdef NW_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace {
+    int openAppend(const std::string& path) {
+        return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+    }
+
+    bool writeAll(int file, std::string_view first, std::string_view second) {
+        for (auto part : {first, second}) {
+            while (!part.empty()) {
+                const auto done = _write(file, part.data(), static_cast<unsigned>(part.size()));
+                if (done < 0)
+                    return false;
+                part.remove_prefix(static_cast<size_t>(done));
+            }
+        }
+        return true;
+    }
+
+    void syncData(int file) { _commit(file); }
+
+    uint64_t fileSize(int file) { return static_cast<uint64_t>(_lseeki64(file, 0, SEEK_END)); }
+
+    void closeFile(int file) { _close(file); }
+}
+
+#else
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+namespace {
+    int openAppend(const std::string& path) {
+        return open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+
+    // One writev for the whole batch, looping only on short writes
+    bool writeAll(int file, std::string_view first, std::string_view second) {
+        iovec vec[2] = {
+            {const_cast<char*>(first.data()), first.size()},
+            {const_cast<char*>(second.data()), second.size()}
+        };
+        iovec* cur = vec;
+        int count = second.empty() ? 1 : 2;
+        while (count) {
+            const auto done = writev(file, cur, count);
+            if (done < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            auto left = static_cast<size_t>(done);
+            while (count && left >= cur->iov_len) {
+                left -= cur->iov_len;
+                ++cur;
+                --count;
+            }
+            if (count) {
+                cur->iov_base = static_cast<char*>(cur->iov_base) + left;
+                cur->iov_len -= left;
+            }
+        }
+        return true;
+    }
+
+    void syncData(int file) {
+#if BOOST_OS_MACOS
+        fsync(file);
+#else
+        fdatasync(file);
+#endif
+    }
+
+    uint64_t fileSize(int file) { return static_cast<uint64_t>(lseek(file, 0, SEEK_END)); }
+
+    void closeFile(int file) { close(file); }
+}
+
+#endif
+
+namespace {
+    // "logs/Core_<time>.log" -> "logs/Core_<time>.3.log"
+    std::string rotatedName(const std::string& path, uint64_t sequence) {
+        const auto dot = path.rfind('.');
+        const auto slash = path.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return path + '.' + std::to_string(sequence);
+        return path.substr(0, dot) + '.' + std::to_string(sequence) + path.substr(dot);
+    }
+
+    // The rotations of `path` already on the disk, compressed or not, by sequence number
+    std::vector<std::pair<uint64_t, std::string>> findRotated(const std::string& path) {
+        std::vector<std::pair<uint64_t, std::string>> ret;
+        const filesystem::path full(path);
+        const auto name = full.filename().string();
+        const auto dot = name.rfind('.');
+        const auto head = (dot == std::string::npos ? name : name.substr(0, dot)) + '.';
+        const auto tail = dot == std::string::npos ? std::string() : name.substr(dot);
+        const auto dir = full.has_parent_path() ? full.parent_path() : filesystem::path(".");
+        filesystem::error_code ec;
+        for (filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            auto file = it->path().filename().string();
+            const bool gz = file.size() > 3 && file.compare(file.size() - 3, 3, ".gz") == 0;
+            if (gz)
+                file.resize(file.size() - 3);
+            if (file.size() <= head.size() + tail.size() || file.compare(0, head.size(), head) != 0 ||
+                file.compare(file.size() - tail.size(), tail.size(), tail) != 0)
+                continue;
+            const auto digits = file.substr(head.size(), file.size() - head.size() - tail.size());
+            if (digits.size() > 18 || digits.find_first_not_of("0123456789") != std::string::npos)
+                continue;
+            const auto sequence = std::stoull(digits);
+            ret.emplace_back(sequence, rotatedName(path, sequence) + (gz ? ".gz" : ""));
+        }
+        std::sort(ret.begin(), ret.end());
+        return ret;
+    }
+
+#ifdef NW_HAS_ZLIB
+    uint64_t sizeOf(const std::string& path) {
+        filesystem::error_code ec;
+        const auto size = filesystem::file_size(path, ec);
+        return ec ? 0 : static_cast<uint64_t>(size);
+    }
+
+    bool gzipFile(const std::string& from, const std::string& to) {
+        const auto input = std::fopen(from.c_str(), "rb");
+        if (!input)
+            return false;
+        const auto output = gzopen(to.c_str(), "wb");
+        bool ok = output != nullptr;
+        char buffer[64 * 1024];
+        while (ok) {
+            const auto read = std::fread(buffer, 1, sizeof(buffer), input);
+            if (!read) {
+                ok = !std::ferror(input);
+                break;
+            }
+            ok = gzwrite(output, buffer, static_cast<unsigned>(read)) == static_cast<int>(read);
+        }
+        std::fclose(input);
+        if (output && gzclose(output) != Z_OK)
+            ok = false;
+        return ok;
+    }
+#endif
+}
+
+/**
+ * \brief Compresses and prunes rotated files, so that the writing thread only pays for close, rename and open
+ */
+class FileSink::Archiver {
+public:
+    // `existing` are the rotated files left by earlier runs, oldest first; the uncompressed ones are compressed
+    Archiver(size_t retention, bool compress, const std::vector<std::pair<uint64_t, std::string>>& existing)
+            : mRetention(retention), mCompress(compress) {
+        for (auto& x : existing) {
+#ifdef NW_HAS_ZLIB
+            // An original next to its compressed copy means compression was cut short, so it is done again
+            if (mCompress && !mKept.empty() && mKept.back().first == x.first)
+                continue;
+            if (mCompress && x.second.compare(x.second.size() - 3, 3, ".gz") != 0)
+                mJobs.push_back(x);
+#endif
+            // Holds the place of a file being compressed, so that it is pruned in the order it was rotated in
+            mKept.push_back(x);
+        }
+        mThread = std::thread([this]() { run(); });
+    }
+
+    // Finishes the queued files before returning
+    ~Archiver() {
+        {
+            std::lock_guard<std::mutex> lk(mLock);
+            mStop = true;
+        }
+        mSignal.notify_one();
+        mThread.join();
+    }
+
+    void post(uint64_t sequence, std::string path) {
+        {
+            std::lock_guard<std::mutex> lk(mLock);
+            mJobs.emplace_back(sequence, std::move(path));
+        }
+        mSignal.notify_one();
+    }
+
+    uint64_t in() const noexcept { return mIn.load(std::memory_order_relaxed); }
+
+    uint64_t out() const noexcept { return mOut.load(std::memory_order_relaxed); }
+private:
+    void run() {
+        prune();
+        std::unique_lock<std::mutex> lk(mLock);
+        for (;;) {
+            mSignal.wait(lk, [this]() { return mStop || !mJobs.empty(); });
+            if (mJobs.empty())
+                return;
+            auto job = std::move(mJobs.front());
+            mJobs.pop_front();
+            lk.unlock();
+            archive(job.first, job.second);
+            lk.lock();
+        }
+    }
+
+    void archive(uint64_t sequence, const std::string& path) {
+        auto kept = path;
+#ifdef NW_HAS_ZLIB
+        if (mCompress) {
+            const auto target = path + ".gz";
+            if (gzipFile(path, target)) {
+                mIn.fetch_add(sizeOf(path), std::memory_order_relaxed);
+                mOut.fetch_add(sizeOf(target), std::memory_order_relaxed);
+                std::remove(path.c_str());
+                kept = target;
+            }
+            else
+                std::remove(target.c_str());
+        }
+#endif
+        const auto pos = std::lower_bound(mKept.begin(), mKept.end(), sequence,
+                                          [](const auto& x, uint64_t seq) { return x.first < seq; });
+        if (pos != mKept.end() && pos->first == sequence)
+            pos->second = std::move(kept);
+        else
+            mKept.emplace(pos, sequence, std::move(kept));
+        prune();
+    }
+
+    void prune() {
+        while (mRetention && mKept.size() > mRetention) {
+            const auto& oldest = mKept.front();
+            std::remove(oldest.second.c_str());
+            // Still waiting for compression: drop the job, and a partial copy a crash may have left
+            std::unique_lock<std::mutex> lk(mLock);
+            const auto job = std::find_if(mJobs.begin(), mJobs.end(),
+                                          [&](const auto& x) { return x.first == oldest.first; });
+            if (job != mJobs.end()) {
+                mJobs.erase(job);
+                lk.unlock();
+                std::remove((oldest.second + ".gz").c_str());
+            }
+            mKept.pop_front();
+        }
+    }
+
+    size_t mRetention;
+    bool mCompress;
+    std::mutex mLock;
+    std::condition_variable mSignal;
+    // Rotated files by sequence number
+    std::deque<std::pair<uint64_t, std::string>> mJobs;
+    bool mStop = false;
+    // Rotated files still on the disk, oldest first. Only touched by the worker
+    std::deque<std::pair<uint64_t, std::string>> mKept;
+    std::atomic<uint64_t> mIn{0}, mOut{0};
+    std::thread mThread;
+};
+
+FileSink::FileSink(const std::string& path) : FileSink(path, Options()) {}
+
+FileSink::FileSink(const std::string& path, Options options)
+        : mPath(path), mOptions(options), mFile(openAppend(path)) {
+    if (mFile < 0)
+        throw std::runtime_error("Failed to open log file " + path);
+    mBuffer.reserve(mOptions.batchBytes);
+    mLastSync = Clock::now();
+    mFileBytes = fileSize(mFile);
+    if (mOptions.maxBytes || mOptions.rotateInterval.count()) {
+        // Continue the numbering of earlier runs, so that their rotations are neither overwritten nor forgotten
+        const auto existing = findRotated(mPath);
+        mSequence = existing.empty() ? 0 : existing.back().first;
+        mArchiver = std::make_unique<Archiver>(mOptions.retention, mOptions.compress, existing);
+        scheduleRotation();
+    }
+}
+
+FileSink::~FileSink() {
+    writeOut();
+    if (mOptions.sync != Sync::never && mDirty)
+        syncData(mFile);
+    if (mFile >= 0)
+        closeFile(mFile);
+}
+
+void FileSink::write(const LogRecord& record) { append(record.text, record.level >= mOptions.flushLevel); }
+
+void FileSink::append(std::string_view bytes, bool urgent) {
+    mRecords.fetch_add(1, std::memory_order_relaxed);
+    ++mPending;
+    const auto now = Clock::now();
+    if (mBuffer.size() + bytes.size() > mOptions.batchBytes) {
+        if (bytes.size() > mOptions.batchBytes) {
+            // Too large to batch, send it along with whatever is pending
+            mUrgent |= urgent;
+            writeOut(bytes);
+            return;
+        }
+        writeOut();
+    }
+    if (mBuffer.empty())
+        mFirst = now;
+    mBuffer.append(bytes);
+    mUrgent |= urgent;
+    if (mUrgent || mBuffer.size() >= mOptions.batchBytes || now - mFirst >= mOptions.flushInterval)
+        writeOut();
+}
+
+void FileSink::flush() { writeOut(); }
+
+void FileSink::idle() {
+    const auto now = Clock::now();
+    if (!mBuffer.empty() && now - mFirst >= mOptions.flushInterval)
+        writeOut();
+    else if (mOptions.sync == Sync::periodic && mDirty && now - mLastSync >= mOptions.syncInterval) {
+        syncData(mFile);
+        mLastSync = now;
+        mDirty = false;
+        mSyncs.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if (mBuffer.empty())
+        rotateIfDue(0);
+}
+
+void FileSink::writeOut(std::string_view extra) {
+    if (mBuffer.empty() && extra.empty())
+        return;
+    const auto start = Clock::now();
+    const auto size = mBuffer.size() + extra.size();
+    rotateIfDue(size);
+    if (mFile < 0 && (mFile = openAppend(mPath)) >= 0)
+        mFileBytes = fileSize(mFile);
+    if (mFile >= 0 && writeAll(mFile, mBuffer, extra)) {
+        mBytes.fetch_add(size, std::memory_order_relaxed);
+        mFileBytes += size;
+        mDirty = true;
+        mFailed = false;
+    }
+    else {
+        mLost.fetch_add(mPending, std::memory_order_relaxed);
+        fail(mFile < 0 ? "reopen" : "write to");
+    }
+    mPending = 0;
+    mBatches.fetch_add(1, std::memory_order_relaxed);
+    mBuffer.clear();
+    const bool sync = mOptions.sync != Sync::never && (mUrgent ||
+            (mOptions.sync == Sync::periodic && start - mLastSync >= mOptions.syncInterval));
+    mUrgent = false;
+    if (sync) {
+        syncData(mFile);
+        mLastSync = start;
+        mDirty = false;
+        mSyncs.fetch_add(1, std::memory_order_relaxed);
+    }
+    const auto spent = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - start).count());
+    mFlushTotal.fetch_add(spent, std::memory_order_relaxed);
+    if (spent > mFlushMax.load(std::memory_order_relaxed))
+        mFlushMax.store(spent, std::memory_order_relaxed);
+}
+
+// Reported once until a write succeeds again; the records are counted in Stats::lost either way
+void FileSink::fail(const char* what) noexcept {
+    if (mFailed)
+        return;
+    mFailed = true;
+    std::fprintf(stderr, "FileSink: cannot %s %s: %s\n", what, mPath.c_str(), std::strerror(errno));
+}
+
+void FileSink::rotateIfDue(size_t incoming) {
+    if (!mArchiver)
+        return;
+    bool due = mOptions.maxBytes && mFileBytes + incoming > mOptions.maxBytes;
+    if (mOptions.rotateInterval.count() && std::chrono::system_clock::now() >= mRotateAt) {
+        due = true;
+        // Nothing was written during the last interval, there is nothing to close either
+        if (!mFileBytes)
+            scheduleRotation();
+    }
+    if (due && mFileBytes)
+        rotate();
+}
+
+void FileSink::rotate() {
+    const auto start = Clock::now();
+    if (mOptions.sync != Sync::never && mDirty)
+        syncData(mFile);
+    if (mFile >= 0)
+        closeFile(mFile);
+    const auto rotated = rotatedName(mPath, ++mSequence);
+    const bool moved = std::rename(mPath.c_str(), rotated.c_str()) == 0;
+    // If the rename failed, keep appending to the old file rather than losing records. If the open fails,
+    // writeOut retries it on every batch
+    mFile = openAppend(mPath);
+    mFileBytes = (moved || mFile < 0) ? 0 : fileSize(mFile);
+    if (mFile < 0)
+        fail("reopen");
+    mDirty = false;
+    scheduleRotation();
+    if (moved)
+        mArchiver->post(mSequence, rotated);
+    const auto spent = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - start).count());
+    mRotations.fetch_add(1, std::memory_order_relaxed);
+    mRotateTotal.fetch_add(spent, std::memory_order_relaxed);
+    if (spent > mRotateMax.load(std::memory_order_relaxed))
+        mRotateMax.store(spent, std::memory_order_relaxed);
+}
+
+void FileSink::scheduleRotation() noexcept {
+    const auto interval = mOptions.rotateInterval;
+    if (!interval.count())
+        return;
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now);
+    mRotateAt = std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>((elapsed / interval + 1) * interval));
+}
+
+FileSink::Stats FileSink::stats() const noexcept {
+    return {
+        mRecords.load(std::memory_order_relaxed), mBytes.load(std::memory_order_relaxed),
+        mBatches.load(std::memory_order_relaxed), mSyncs.load(std::memory_order_relaxed),
+        std::chrono::nanoseconds(mFlushTotal.load(std::memory_order_relaxed)),
+        std::chrono::nanoseconds(mFlushMax.load(std::memory_order_relaxed)),
+        mRotations.load(std::memory_order_relaxed),
+        std::chrono::nanoseconds(mRotateTotal.load(std::memory_order_relaxed)),
+        std::chrono::nanoseconds(mRotateMax.load(std::memory_order_relaxed)),
+        mArchiver ? mArchiver->in() : 0, mArchiver ? mArchiver->out() : 0,
+        mLost.load(std::memory_order_relaxed)
+    };
+}
@@ -0,0 +1,303 @@
+//
+// Core: FlightRecorder.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include "Core/FlightRecorder.h"
+#include "Core/Console.h"
+
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+std::atomic_int FlightRecorder::capture{static_cast<int>(Logger::Level::fatal) + 1};
+
+namespace {
+    constexpr size_t maxRings = 256;
+
+    // Followed by the text of the record. `sequence` is 2n + 1 while record n is written and 2n + 2 once it is done
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};
+        uint64_t time = 0;
+        uint32_t length = 0;
+    };
+
+    // A ring of fixed-size slots written by the single thread owning it; a dump reads it concurrently
+    // and skips slots that are overwritten while being read
+    class Ring {
+    public:
+        Ring(size_t slots, size_t textBytes)
+                : mSlots(slots), mTextBytes(textBytes),
+                  mStride((sizeof(Slot) + textBytes + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot)),
+                  mStorage(std::make_unique<Storage[]>((mStride * slots + sizeof(Storage) - 1) / sizeof(Storage))) {
+            for (size_t i = 0; i < slots; ++i)
+                new(reinterpret_cast<char*>(mStorage.get()) + i * mStride) Slot();
+        }
+
+        void push(std::string_view text) noexcept {
+            const auto n = head.load(std::memory_order_relaxed);
+            auto& slot = at(n);
+            slot.sequence.store(2 * n + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count());
+            slot.length = static_cast<uint32_t>(std::min(text.size(), mTextBytes));
+            std::memcpy(textOf(slot), text.data(), slot.length);
+            slot.sequence.store(2 * n + 2, std::memory_order_release);
+            head.store(n + 1, std::memory_order_release);
+        }
+
+        // Time of record n, or false if it is being overwritten
+        bool peek(uint64_t n, uint64_t& time) noexcept {
+            auto& slot = at(n);
+            if (slot.sequence.load(std::memory_order_acquire) != 2 * n + 2)
+                return false;
+            time = slot.time;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return slot.sequence.load(std::memory_order_relaxed) == 2 * n + 2;
+        }
+
+        // Copies the text of record n, returns its length or -1 if it is being overwritten
+        ptrdiff_t read(uint64_t n, char* out) noexcept {
+            auto& slot = at(n);
+            if (slot.sequence.load(std::memory_order_acquire) != 2 * n + 2)
+                return -1;
+            const auto length = std::min<size_t>(slot.length, mTextBytes);
+            std::memcpy(out, textOf(slot), length);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return slot.sequence.load(std::memory_order_relaxed) == 2 * n + 2 ? static_cast<ptrdiff_t>(length) : -1;
+        }
+
+        size_t slots() const noexcept { return mSlots; }
+
+        // Number of records ever pushed
+        std::atomic<uint64_t> head{0};
+        // Cleared when the owning thread exits, the next new thread takes the ring over
+        std::atomic<bool> owned{true};
+        // Records before this one were written by an earlier dump. Only touched while dumping
+        uint64_t dumped = 0;
+    private:
+        using Storage = std::aligned_storage_t<sizeof(Slot), alignof(Slot)>;
+
+        Slot& at(uint64_t n) noexcept {
+            return *reinterpret_cast<Slot*>(reinterpret_cast<char*>(mStorage.get()) + (n % mSlots) * mStride);
+        }
+
+        char* textOf(Slot& slot) noexcept { return reinterpret_cast<char*>(&slot) + sizeof(Slot); }
+
+        size_t mSlots, mTextBytes, mStride;
+        std::unique_ptr<Storage[]> mStorage;
+    };
+
+    struct State {
+        // Rings are never freed, so that a dump can always read them
+        std::atomic<Ring*> rings[maxRings]{};
+        std::atomic<size_t> ringCount{0};
+        size_t slots = 0, slotBytes = 0;
+        int file = -1;
+        std::atomic<uint64_t> lost{0};
+        // Everything below is only used while `dumping` is set
+        std::atomic_flag dumping = ATOMIC_FLAG_INIT;
+        std::unique_ptr<char[]> text, plain;
+        uint64_t cursors[maxRings]{}, ends[maxRings]{};
+    } state;
+
+    struct Attachment {
+        Ring* ring = nullptr;
+        bool detached = false;
+
+        ~Attachment() {
+            if (ring)
+                ring->owned.store(false, std::memory_order_release);
+            ring = nullptr;
+            detached = true;
+        }
+    };
+
+    thread_local Attachment attachment;
+
+    Ring* attach() noexcept {
+        // Reuse the ring of an exited thread first, its records stay dumpable until they are overwritten
+        const auto count = std::min(state.ringCount.load(std::memory_order_acquire), maxRings);
+        for (size_t i = 0; i < count; ++i) {
+            const auto ring = state.rings[i].load(std::memory_order_acquire);
+            bool expected = false;
+            if (ring && !ring->owned.load(std::memory_order_relaxed) &&
+                ring->owned.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return ring;
+        }
+        const auto index = state.ringCount.fetch_add(1, std::memory_order_acq_rel);
+        if (index >= maxRings)
+            return nullptr;
+        try {
+            const auto ring = new Ring(state.slots, state.slotBytes);
+            state.rings[index].store(ring, std::memory_order_release);
+            return ring;
+        }
+        catch (std::bad_alloc&) {
+            return nullptr;
+        }
+    }
+
+    void writeAll(const char* data, size_t length) noexcept {
+        while (length) {
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+            const auto done = _write(state.file, data, static_cast<unsigned>(length));
+#else
+            const auto done = ::write(state.file, data, length);
+#endif
+            if (done <= 0)
+                return;
+            data += done;
+            length -= static_cast<size_t>(done);
+        }
+    }
+
+    void writeText(const char* text) noexcept { writeAll(text, std::strlen(text)); }
+
+    // Color markup is dropped, the dump is meant for files
+    size_t stripMarkup(const char* text, size_t length, char* out) noexcept {
+        size_t size = 0;
+        for (size_t i = 0; i < length; ++i) {
+            if (text[i] == '&' && i + 1 < length) {
+                if (LColor::codeIndex(text[i + 1]) >= 0) {
+                    ++i;
+                    continue;
+                }
+                if (text[i + 1] == '&')
+                    ++i;
+            }
+            out[size++] = text[i];
+        }
+        return size;
+    }
+
+    void onSignal(int signal) {
+        char reason[] = "signal    ";
+        auto pos = std::strlen("signal ");
+        if (signal >= 100)
+            reason[pos++] = static_cast<char>('0' + signal / 100 % 10);
+        if (signal >= 10)
+            reason[pos++] = static_cast<char>('0' + signal / 10 % 10);
+        reason[pos++] = static_cast<char>('0' + signal % 10);
+        reason[pos] = '\0';
+        FlightRecorder::dump(reason);
+        std::signal(signal, SIG_DFL);
+        std::raise(signal);
+    }
+}
+
+void FlightRecorder::enable(const std::string& path, Logger::Level level, size_t slots, size_t slotBytes,
+                            bool signals) {
+    std::lock_guard<std::mutex> lk(Logger::mutex);
+    if (state.file >= 0)
+        throw std::runtime_error("FlightRecorder is already enabled");
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+    const auto file = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    const auto file = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+    if (file < 0)
+        throw std::runtime_error("Failed to open flight recorder dump file " + path);
+    state.slots = std::max<size_t>(slots, 1);
+    state.slotBytes = slotBytes;
+    state.text = std::make_unique<char[]>(slotBytes);
+    state.plain = std::make_unique<char[]>(slotBytes + 1);
+    state.file = file;
+    capture.store(static_cast<int>(level), std::memory_order_release);
+    Logger::updateGate();
+    if (signals) {
+#if !(BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+        std::signal(SIGBUS, onSignal);
+#endif
+        for (auto signal : {SIGSEGV, SIGILL, SIGFPE, SIGABRT})
+            std::signal(signal, onSignal);
+    }
+}
+
+void FlightRecorder::record(std::string_view text) noexcept {
+    auto ring = attachment.ring;
+    if (!ring) {
+        // Pairs with the store in enable(), so that the sizes are visible
+        if (attachment.detached || capture.load(std::memory_order_acquire) > static_cast<int>(Logger::Level::fatal))
+            return;
+        if (ring = attach(); !ring) {
+            state.lost.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        attachment.ring = ring;
+    }
+    ring->push(text);
+}
+
+void FlightRecorder::dump(const char* reason) noexcept {
+    if (state.file < 0 || state.dumping.test_and_set(std::memory_order_acquire))
+        return;
+    writeText("---- flight recorder dump: ");
+    writeText(reason);
+    writeText(" ----\n");
+    const auto count = std::min(state.ringCount.load(std::memory_order_acquire), maxRings);
+    for (size_t i = 0; i < count; ++i) {
+        const auto ring = state.rings[i].load(std::memory_order_acquire);
+        const auto head = ring ? ring->head.load(std::memory_order_acquire) : 0;
+        state.ends[i] = head;
+        state.cursors[i] = ring ? std::max(ring->dumped, head > ring->slots() ? head - ring->slots() : 0) : 0;
+    }
+    // Each ring is in time order already, so repeatedly taking the oldest head merges them
+    for (;;) {
+        size_t best = maxRings;
+        uint64_t bestTime = 0;
+        for (size_t i = 0; i < count; ++i) {
+            const auto ring = state.rings[i].load(std::memory_order_relaxed);
+            for (uint64_t time; state.cursors[i] < state.ends[i]; ++state.cursors[i]) {
+                if (ring->peek(state.cursors[i], time)) {
+                    if (best == maxRings || time < bestTime) {
+                        best = i;
+                        bestTime = time;
+                    }
+                    break;
+                }
+            }
+        }
+        if (best == maxRings)
+            break;
+        const auto ring = state.rings[best].load(std::memory_order_relaxed);
+        if (const auto length = ring->read(state.cursors[best]++, state.text.get()); length >= 0) {
+            auto size = stripMarkup(state.text.get(), static_cast<size_t>(length), state.plain.get());
+            if (!size || state.plain[size - 1] != '\n')
+                state.plain[size++] = '\n'; // Truncated
+            writeAll(state.plain.get(), size);
+        }
+    }
+    for (size_t i = 0; i < count; ++i)
+        if (const auto ring = state.rings[i].load(std::memory_order_relaxed); ring)
+            ring->dumped = state.ends[i];
+    state.dumping.clear(std::memory_order_release);
+}
+
+uint64_t FlightRecorder::lostCount() noexcept { return state.lost.load(std::memory_order_relaxed); }
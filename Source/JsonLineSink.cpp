@@ -0,0 +1,82 @@
+//
+// Core: JsonLineSink.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <ctime>
+#include <charconv>
+#include "Core/JsonLineSink.h"
+
+namespace {
+    constexpr const char* levelNames[] = {"verbose", "debug", "info", "warning", "error", "fatal"};
+}
+
+JsonLineSink::JsonLineSink(const std::string& path) : JsonLineSink(path, Options()) {}
+
+JsonLineSink::JsonLineSink(const std::string& path, Options options) : FileSink(path, options) {
+    mLine.reserve(512);
+}
+
+void JsonLineSink::write(const LogRecord& record) {
+    const auto put = [this](const char* data, size_t length) { mLine.append(data, length); };
+    mLine.assign("{\"time\":\"");
+    putTime(record.time);
+    mLine.append("\",\"level\":\"");
+    mLine.append(levelNames[static_cast<size_t>(record.level)]);
+    mLine.append("\",\"component\":\"");
+    escapeJson(record.component, put);
+    mLine.append("\",\"thread\":");
+    char number[24];
+    mLine.append(number, std::to_chars(number, number + sizeof(number), record.thread).ptr);
+    mLine.append(",\"message\":\"");
+    escapeJson(record.message, put);
+    mLine.push_back('"');
+    if (!record.fields.empty()) {
+        mLine.append(",\"fields\":{");
+        mLine.append(record.fields);
+        mLine.push_back('}');
+    }
+    mLine.append("}\n");
+    append(mLine, record.level >= options().flushLevel);
+}
+
+// UTC with microseconds; the date part is only formatted once per second
+void JsonLineSink::putTime(std::chrono::system_clock::time_point time) {
+    const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+    auto second = micros / 1000000;
+    auto fraction = micros % 1000000;
+    if (fraction < 0) {
+        --second;
+        fraction += 1000000;
+    }
+    if (second != mSecond) {
+        const auto timer = static_cast<std::time_t>(second);
+        tm parts;
+#if BOOST_COMP_MSVC
+        gmtime_s(&parts, &timer);
+#else
+        gmtime_r(&timer, &parts);
+#endif
+        std::strftime(mSecondText, sizeof(mSecondText), "%Y-%m-%dT%H:%M:%S", &parts);
+        mSecond = second;
+    }
+    char digits[8] = {'.', '0', '0', '0', '0', '0', '0', 'Z'};
+    for (int i = 6; i > 0; --i, fraction /= 10)
+        digits[i] = static_cast<char>('0' + fraction % 10);
+    mLine.append(mSecondText, 19);
+    mLine.append(digits, sizeof(digits));
+}
@@ -17,16 +17,37 @@
 // along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
 // 
 
-#include <map>
 #include <ctime>
-#include <fstream>
+#include <cmath>
+#include <cstdio>
+#include <charconv>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <memory>
 #include <iostream>
+#include <condition_variable>
+#include <boost/predef/os.h>
 #include "Core/Logger.h"
+#include "Core/FileSink.h"
+#include "Core/FlightRecorder.h"
 #include "Core/Filesystem.h"
 #include "Core/Console.h"
+#include "Core/EventBus.h"
+#include "Core/JsonHelper.h"
+
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+#include "Windows.hpp"
+#elif BOOST_OS_LINUX
+#include <unistd.h>
+#include <sys/syscall.h>
+#else
+#include <pthread.h>
+#endif
 
 std::mutex Logger::mutex;
-std::vector<std::ofstream> Logger::fsink;
+std::vector<std::unique_ptr<LogSink>> Logger::sinks;
 std::array<const char*, 6> Logger::levelTags
 {
     "[verbose]", "[debug]", "[info]", "[warning]", "[error]", "[fatal]"
@@ -35,130 +56,863 @@ Logger::Level Logger::coutLevel = Level::verbose;
 Logger::Level Logger::cerrLevel = Level::fatal;
 Logger::Level Logger::fileLevel = Level::info;
 Logger::Level Logger::lineLevel = Level::error;
+std::atomic_int Logger::gate{static_cast<int>(Level::verbose)};
+std::array<std::atomic_int, Logger::maxComponents> Logger::componentGates{};
+std::array<std::atomic_int, Logger::maxComponents> Logger::componentOutputs{};
+std::array<int, Logger::maxComponents> Logger::componentLevels{};
+std::atomic<Logger::RateLimit::Summary*> Logger::limitedSites{nullptr};
 
-template <size_t length>
-static std::string convert(int arg) {
-    char arr[13];
-    int siz = 0u;
-    while (arg) {
-        arr[siz++] = (arg % 10) + '0';
-        arg /= 10;
-    }
-    std::string ret(length - siz, '0');
-    ret.reserve(length);
-    for (int i = siz - 1; i >= 0; i--)
-        ret += arr[i];
-    return ret;
+// What the summaries of a site need, with copies of the strings: a RateLimit is a static of the module using it
+struct Logger::RateLimit::Summary {
+    std::string file, func, component;
+    int line, componentId;
+    Level level;
+    std::atomic<uint64_t> suppressed{0}, lastEmitted{0};
+    Summary* next = nullptr;
+};
+
+namespace {
+    // Bounded lock-free queue (D. Vyukov's sequence-per-cell design). Any thread may push or pop, which lets a
+    // producer evict the oldest entry itself when the queue is full
+    template <class T>
+    class RingQueue {
+    public:
+        explicit RingQueue(size_t capacity) {
+            size_t size = 2;
+            while (size < capacity)
+                size <<= 1;
+            mMask = size - 1;
+            mCells = std::make_unique<Cell[]>(size);
+            for (size_t i = 0; i < size; ++i)
+                mCells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        size_t capacity() const noexcept { return mMask + 1; }
+
+        template <class Func>
+        bool tryPush(Func&& fill) {
+            auto pos = mTail.load(std::memory_order_relaxed);
+            for (;;) {
+                auto& cell = mCells[pos & mMask];
+                const auto seq = cell.sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                if (diff == 0) {
+                    if (mTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        fill(cell.value);
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                    return false;
+                else
+                    pos = mTail.load(std::memory_order_relaxed);
+            }
+        }
+
+        template <class Func>
+        bool tryPop(Func&& consume) {
+            auto pos = mHead.load(std::memory_order_relaxed);
+            for (;;) {
+                auto& cell = mCells[pos & mMask];
+                const auto seq = cell.sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+                if (diff == 0) {
+                    if (mHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        consume(cell.value);
+                        cell.sequence.store(pos + mMask + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                    return false;
+                else
+                    pos = mHead.load(std::memory_order_relaxed);
+            }
+        }
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+        size_t mMask = 0;
+        std::unique_ptr<Cell[]> mCells;
+        alignas(64) std::atomic<size_t> mTail{0};
+        alignas(64) std::atomic<size_t> mHead{0};
+    };
 }
 
-static std::string getTimeString(char dateSplit, char midSplit, char timeSplit) {
-    time_t timer = time(nullptr);
+// Owns the writer thread used in asynchronous mode. Producers only touch the queue and a few counters; the mutex
+// here is taken by the writer thread to sleep and never by a producer unless the writer is actually asleep
+class LoggerBackend {
+public:
+    ~LoggerBackend() { stop(); }
+
+    void start(size_t capacity, Logger::Overflow policy) {
+        std::lock_guard<std::mutex> control(mControl);
+        stopLocked();
+        mQueue = std::make_unique<RingQueue<Record>>(capacity);
+        mPolicy = policy;
+        mExit = false;
+        mThread = std::thread([this]() { run(); });
+        mActive.store(true);
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> control(mControl);
+        stopLocked();
+    }
+
+    // Returns false if the backend is not running, in which case the caller has to write the record itself
+    bool push(Logger::Level level, const std::string& content, const Logger::RecordInfo& info) {
+        mProducers.fetch_add(1);
+        if (!mActive.load()) {
+            mProducers.fetch_sub(1);
+            return false;
+        }
+        const auto fill = [&](Record& rec) {
+            rec.level = level;
+            rec.content.assign(content);
+            rec.fields.assign(info.fields);
+            rec.info = info;
+        };
+        while (!mQueue->tryPush(fill)) {
+            if (mPolicy == Logger::Overflow::dropNewest) {
+                mDropped.fetch_add(1, std::memory_order_relaxed);
+                mProducers.fetch_sub(1);
+                return true;
+            }
+            if (mPolicy == Logger::Overflow::overwriteOldest) {
+                if (mQueue->tryPop([](Record&) noexcept {})) {
+                    mDropped.fetch_add(1, std::memory_order_relaxed);
+                    mWritten.fetch_add(1);
+                }
+            }
+            else {
+                wake();
+                std::this_thread::yield();
+            }
+        }
+        mPushed.fetch_add(1);
+        mProducers.fetch_sub(1);
+        if (mSleeping.load())
+            wake();
+        return true;
+    }
+
+    void flush() {
+        if (!mActive.load())
+            return;
+        const auto target = mPushed.load();
+        std::unique_lock<std::mutex> lk(mLock);
+        mFlushRequested = true;
+        mWake.notify_one();
+        mDrained.wait(lk, [&]() { return mWritten.load() >= target || !mActive.load(); });
+    }
+
+    uint64_t dropped() const noexcept { return mDropped.load(std::memory_order_relaxed); }
+private:
+    struct Record {
+        Record() { content.reserve(256); }
+        Logger::Level level = Logger::Level::verbose;
+        std::string content, fields;
+        Logger::RecordInfo info{};
+    };
+
+    void stopLocked() {
+        if (!mThread.joinable())
+            return;
+        mActive.store(false);
+        while (mProducers.load())
+            std::this_thread::yield();
+        {
+            std::lock_guard<std::mutex> lk(mLock);
+            mExit = true;
+            mWake.notify_one();
+        }
+        mThread.join();
+        mDrained.notify_all();
+    }
+
+    void wake() {
+        std::lock_guard<std::mutex> lk(mLock);
+        mWake.notify_one();
+    }
+
+    // Writes out whatever is queued, holding Logger::mutex once per batch rather than once per record
+    size_t drain() {
+        size_t count = 0;
+        std::lock_guard<std::mutex> sinks(Logger::mutex);
+        const auto batch = mQueue->capacity();
+        const auto write = [](Record& rec) {
+            auto info = rec.info;
+            info.fields = rec.fields;
+            Logger::writeRecord(rec.level, rec.content, info);
+        };
+        while (count < batch && mQueue->tryPop(write))
+            ++count;
+        return count;
+    }
+
+    void run() {
+        for (;;) {
+            if (const auto count = drain(); count) {
+                mWritten.fetch_add(count);
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> sinks(Logger::mutex);
+                for (auto& it : Logger::sinks)
+                    it->idle();
+            }
+            // Straight to the sinks: pushing would wait on this very thread once the queue is full
+            Logger::reportSuppressed(false, true);
+            std::unique_lock<std::mutex> lk(mLock);
+            if (mFlushRequested || mWritten.load() >= mPushed.load()) {
+                mFlushRequested = false;
+                mDrained.notify_all();
+            }
+            if (mExit && mWritten.load() >= mPushed.load())
+                break;
+            mSleeping.store(true);
+            // Re-check after announcing the nap, a producer might have pushed without seeing mSleeping
+            if (mWritten.load() >= mPushed.load() && !mExit)
+                mWake.wait_for(lk, std::chrono::milliseconds(100));
+            mSleeping.store(false);
+        }
+        std::lock_guard<std::mutex> sinks(Logger::mutex);
+        std::cout.flush();
+        for (auto& it : Logger::sinks)
+            it->flush();
+    }
+
+    std::unique_ptr<RingQueue<Record>> mQueue;
+    Logger::Overflow mPolicy = Logger::Overflow::block;
+    std::thread mThread;
+    std::mutex mControl, mLock;
+    std::condition_variable mWake, mDrained;
+    bool mExit = false, mFlushRequested = false;
+    std::atomic_bool mActive{false}, mSleeping{false};
+    std::atomic<uint32_t> mProducers{0};
+    std::atomic<uint64_t> mPushed{0}, mWritten{0}, mDropped{0};
+};
+
+static LoggerBackend backend;
+
+namespace {
+    // Resolves the `&` color markup of a record in one pass into an ANSI-colored and a plain copy.
+    // The buffers keep their capacity from record to record
+    class Renderer {
+    public:
+        void render(std::string_view markup, bool colored, bool plain) {
+            mAnsi.clear();
+            mPlain.clear();
+            auto cur = markup.data();
+            const auto end = cur + markup.size();
+            while (cur != end) {
+                const auto mark = static_cast<const char*>(std::memchr(cur, '&', end - cur));
+                const auto segment = mark ? mark : end;
+                append(cur, segment, colored, plain);
+                if (!mark)
+                    break;
+                if (mark + 1 == end) {
+                    append(mark, end, colored, plain);
+                    break;
+                }
+                if (const auto index = LColor::codeIndex(mark[1]); index >= 0) {
+                    if (colored)
+                        mAnsi += LColor::ansi[index];
+                }
+                else if (mark[1] == '&')
+                    append(mark, mark + 1, colored, plain); // Escaped to `&`
+                else
+                    append(mark, mark + 2, colored, plain); // Wrong color code
+                cur = mark + 2;
+            }
+        }
+
+        const std::string& ansi() const noexcept { return mAnsi; }
+
+        const std::string& plain() const noexcept { return mPlain; }
+    private:
+        void append(const char* begin, const char* end, bool colored, bool plain) {
+            if (colored)
+                mAnsi.append(begin, end);
+            if (plain)
+                mPlain.append(begin, end);
+        }
+
+        std::string mAnsi, mPlain;
+    };
+
+    enum class ConsoleMode { plain, ansi, legacy };
+
+    // Colors are only emitted to consoles; `legacy` is a console colored through API calls (old Windows consoles)
+    ConsoleMode consoleMode(std::FILE* stream) noexcept {
+        if (LColorFunc::supportsAnsi(stream))
+            return ConsoleMode::ansi;
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+        return LColorFunc::isTerminal(stream) ? ConsoleMode::legacy : ConsoleMode::plain;
+#else
+        return ConsoleMode::plain;
+#endif
+    }
+
+    constexpr std::string_view levelNames[] = {"verbose", "debug", "info", "warning", "error", "fatal"};
+
+    // Interned component names, indexed by id; id 0 is shared by the components that did not fit.
+    // A function-local static, as modules intern their names during static initialization. Guarded by Logger::mutex
+    std::vector<std::string>& componentNames() {
+        static std::vector<std::string> names{""};
+        return names;
+    }
+
+    int intern(std::string_view name) {
+        auto& names = componentNames();
+        for (size_t i = 1; i < names.size(); ++i)
+            if (names[i] == name)
+                return static_cast<int>(i);
+        if (names.size() == Logger::maxComponents)
+            return 0;
+        names.emplace_back(name);
+        return static_cast<int>(names.size() - 1);
+    }
+
+    // The console command registered by Logger::loadLevels
+    bool setLogLevel(const std::string& component, const std::string& level) {
+        if (level == "default") {
+            Logger::clearComponentLevel(component);
+            return true;
+        }
+        const auto it = std::find(std::begin(levelNames), std::end(levelNames), level);
+        if (it == std::end(levelNames))
+            return false;
+        Logger::setComponentLevel(component, static_cast<Logger::Level>(it - std::begin(levelNames)));
+        return true;
+    }
+
+    // "12,381"
+    std::string groupDigits(uint64_t value) {
+        auto digits = std::to_string(value);
+        for (auto pos = static_cast<ptrdiff_t>(digits.size()) - 3; pos > 0; pos -= 3)
+            digits.insert(static_cast<size_t>(pos), 1, ',');
+        return digits;
+    }
+
+    // FNV-1a
+    uint64_t hashMessage(std::string_view text) noexcept {
+        uint64_t hash = 14695981039346656037ull;
+        for (const auto ch : text)
+            hash = (hash ^ static_cast<unsigned char>(ch)) * 1099511628211ull;
+        return hash;
+    }
+
+    // Appends everything written to the stream to a string, without a put area of its own
+    class StringBuf : public std::streambuf {
+    public:
+        std::string text;
+    protected:
+        int_type overflow(int_type ch) override {
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+                text.push_back(traits_type::to_char_type(ch));
+            return traits_type::not_eof(ch);
+        }
+
+        std::streamsize xsputn(const char* data, std::streamsize count) override {
+            text.append(data, static_cast<size_t>(count));
+            return count;
+        }
+    };
+
+    struct Formatter {
+        Formatter() : stream(&buffer) { buffer.text.reserve(256); }
+        StringBuf buffer;
+        std::ostream stream;
+    };
+
+    // The formatters of a thread, one for each Logger alive on it: a record logged while another one is being
+    // built (from a function called in its `<<` chain, or a rate limit summary) takes the next one
+    class FormatterStack {
+    public:
+        std::ostream& acquire() {
+            if (mDepth == mItems.size())
+                mItems.push_back(std::make_unique<Formatter>());
+            auto& stream = mItems[mDepth++]->stream;
+            stream.flags(std::ios_base::dec | std::ios_base::skipws);
+            stream.precision(6);
+            stream.fill(' ');
+            stream.width(0);
+            stream.clear();
+            return stream;
+        }
+
+        void release() noexcept {
+            auto& text = mItems[--mDepth]->buffer.text;
+            // Do not hold on to the memory of an exceptionally long record
+            if (text.capacity() > 64 * 1024)
+                std::string().swap(text);
+            text.clear();
+        }
+    private:
+        std::vector<std::unique_ptr<Formatter>> mItems;
+        size_t mDepth = 0;
+    };
+
+    thread_local FormatterStack formatters;
+
+    uint64_t threadId() noexcept {
+        thread_local const auto id = []() noexcept -> uint64_t {
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+            return GetCurrentThreadId();
+#elif BOOST_OS_LINUX
+            return static_cast<uint64_t>(syscall(SYS_gettid));
+#else
+            uint64_t tid = 0;
+            pthread_threadid_np(nullptr, &tid);
+            return tid;
+#endif
+        }();
+        return id;
+    }
+}
+
+static size_t formatTime(std::time_t timer, char dateSplit, char midSplit, char timeSplit, char (&out)[20]) {
     tm currtime;
 #if BOOST_COMP_MSVC
     localtime_s(&currtime, &timer); // MSVC
 #else
     localtime_r(&timer, &currtime); // POSIX
 #endif
-    return convert<4u>(currtime.tm_year + 1900) + dateSplit + convert<2u>(currtime.tm_mon)
-        + dateSplit + convert<2u>(currtime.tm_mday) + midSplit + convert<2u>(currtime.tm_hour)
-        + timeSplit + convert<2u>(currtime.tm_min) + timeSplit + convert<2u>(currtime.tm_sec);
+    const auto put = [&out](size_t at, int value, size_t digits) {
+        for (auto i = at + digits; i-- > at; value /= 10)
+            out[i] = static_cast<char>('0' + value % 10);
+    };
+    put(0, currtime.tm_year + 1900, 4);
+    out[4] = dateSplit;
+    put(5, currtime.tm_mon + 1, 2);
+    out[7] = dateSplit;
+    put(8, currtime.tm_mday, 2);
+    out[10] = midSplit;
+    put(11, currtime.tm_hour, 2);
+    out[13] = timeSplit;
+    put(14, currtime.tm_min, 2);
+    out[16] = timeSplit;
+    put(17, currtime.tm_sec, 2);
+    return 19;
+}
+
+static std::string getTimeString(char dateSplit, char midSplit, char timeSplit) {
+    char text[20];
+    return std::string(text, formatTime(std::time(nullptr), dateSplit, midSplit, timeSplit, text));
+}
+
+// The record prefix time, formatted once per second and thread
+static std::string_view recordTime(std::chrono::system_clock::time_point time) {
+    thread_local std::time_t second = -1;
+    thread_local char text[20];
+    thread_local size_t length = 0;
+    if (const auto now = std::chrono::system_clock::to_time_t(time); now != second) {
+        length = formatTime(now, '-', ' ', ':', text);
+        second = now;
+    }
+    return {text, length};
 }
 
 void Logger::addFileSink(const std::string& path, const std::string& prefix) {
     filesystem::create_directory(path);
-    fsink.emplace_back(path + prefix + "_" + getTimeString('-', '_', '-') + ".log");
+    FileSink::Options options;
+    options.maxBytes = 64u << 20u;
+    options.rotateInterval = std::chrono::hours(24);
+    options.retention = 16;
+    addSink(std::make_unique<FileSink>(path + prefix + "_" + getTimeString('-', '_', '-') + ".log", options));
+}
+
+LogSink* Logger::addSink(std::unique_ptr<LogSink> sink) {
+    std::lock_guard<std::mutex> lk(mutex);
+    sinks.push_back(std::move(sink));
+    updateGate();
+    return sinks.back().get();
+}
+
+std::unique_ptr<LogSink> Logger::removeSink(LogSink* sink) {
+    backend.flush();
+    std::lock_guard<std::mutex> lk(mutex);
+    const auto it = std::find_if(sinks.begin(), sinks.end(), [sink](auto& x) { return x.get() == sink; });
+    if (it == sinks.end())
+        return nullptr;
+    auto ret = std::move(*it);
+    sinks.erase(it);
+    ret->flush();
+    updateGate();
+    return ret;
+}
+
+void Logger::setLevels(Level cout, Level cerr, Level file, Level line) {
+    std::lock_guard<std::mutex> lk(mutex);
+    coutLevel = cout;
+    cerrLevel = cerr;
+    fileLevel = file;
+    lineLevel = line;
+    updateGate();
+}
+
+int Logger::componentId(const char* name) {
+    std::lock_guard<std::mutex> lk(mutex);
+    return intern(name);
+}
+
+void Logger::setComponentLevel(const std::string& component, Level level) {
+    std::lock_guard<std::mutex> lk(mutex);
+    if (const auto id = intern(component); id) {
+        componentLevels[id] = static_cast<int>(level) + 1;
+        updateGate();
+    }
+}
+
+void Logger::clearComponentLevel(const std::string& component) {
+    std::lock_guard<std::mutex> lk(mutex);
+    if (const auto id = intern(component); id) {
+        componentLevels[id] = 0;
+        updateGate();
+    }
+}
+
+void Logger::loadLevels() {
+    auto& levels = getSettings()["Logger"]["Levels"];
+    if (levels.is_null())
+        levels = Json::object();
+    for (auto& item : levels.items())
+        if (!item.value().is_string() || !setLogLevel(item.key(), item.value().get<std::string>()))
+            warningstream << "Invalid log level for component " << item.key() << ": " << item.value().dump();
+    static std::once_flag registered;
+    std::call_once(registered, []() { eventBus.registerFunc("setLogLevel", &setLogLevel); });
+}
+
+// Caller holds `mutex`
+Logger::Level Logger::consoleLevel(int component) noexcept {
+    return componentLevels[component] ? static_cast<Level>(componentLevels[component] - 1) : coutLevel;
+}
+
+// Caller holds `mutex`
+Logger::Level Logger::sinkLevel(int component) noexcept {
+    return componentLevels[component] ? static_cast<Level>(componentLevels[component] - 1) : fileLevel;
+}
+
+// Recomputes, for every component, the lowest level that reaches any output or the FlightRecorder.
+// Caller holds `mutex`
+void Logger::updateGate() {
+    int recorded = static_cast<int>(Level::fatal);
+    while (recorded >= 0 && FlightRecorder::captures(static_cast<Level>(recorded)))
+        --recorded;
+    int lowest = recorded + 1;
+    for (size_t i = 0; i < maxComponents; ++i) {
+        const auto id = static_cast<int>(i);
+        auto output = std::min(consoleLevel(id), cerrLevel);
+        if (!sinks.empty())
+            output = std::min(output, sinkLevel(id));
+        const auto passed = std::min(static_cast<int>(output), recorded + 1);
+        componentOutputs[i].store(static_cast<int>(output), std::memory_order_relaxed);
+        componentGates[i].store(passed, std::memory_order_relaxed);
+        lowest = std::min(lowest, passed);
+    }
+    gate.store(lowest, std::memory_order_relaxed);
+}
+
+void Logger::enableAsync(size_t capacity, Overflow policy) { backend.start(capacity, policy); }
+
+void Logger::disableAsync() { backend.stop(); }
+
+void Logger::flush() {
+    reportSuppressed(true);
+    backend.flush();
+    std::lock_guard<std::mutex> lk(mutex);
+    std::cout.flush();
+    for (auto& it : sinks)
+        it->flush();
+}
+
+uint64_t Logger::droppedCount() noexcept { return backend.dropped(); }
+
+void Logger::RateLimit::suppress() noexcept {
+    // Records dropped before the first one of the site is out are not counted
+    if (const auto summary = mSummary.load(std::memory_order_acquire); summary)
+        summary->suppressed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Logger::RateLimit::describe(const char* file, const char* func, int line, Level level, const char* component,
+                                 int componentId) {
+    if (mSummary.load(std::memory_order_acquire))
+        return;
+    auto summary = std::make_unique<Summary>();
+    summary->file = file;
+    summary->func = func;
+    summary->component = component;
+    summary->line = line;
+    summary->componentId = componentId;
+    summary->level = level;
+    summary->lastEmitted.store(clock(), std::memory_order_relaxed);
+    Summary* expected = nullptr;
+    if (!mSummary.compare_exchange_strong(expected, summary.get()))
+        return;
+    const auto listed = summary.release();
+    auto head = limitedSites.load(std::memory_order_relaxed);
+    do
+        listed->next = head;
+    while (!limitedSites.compare_exchange_weak(head, listed, std::memory_order_release, std::memory_order_relaxed));
 }
 
-Logger::Logger(const char* fileName, const char* funcName, int lineNumber, Level level, const char* mgr)
-    : mLevel(level), mLock(mutex) {
+bool Logger::RateLimit::repeated(uint64_t hash, uint64_t now) noexcept {
+    const auto window = static_cast<uint64_t>(std::chrono::nanoseconds(RateLimit::window).count());
+    return mLastHash.exchange(hash, std::memory_order_relaxed) == hash &&
+           now - mLastEmitted.load(std::memory_order_relaxed) < window;
+}
+
+void Logger::reportSuppressed(bool all) { reportSuppressed(all, false); }
+
+void Logger::reportSuppressed(bool all, bool direct) {
+    const auto now = RateLimit::clock();
+    const auto window = static_cast<uint64_t>(std::chrono::nanoseconds(RateLimit::window).count());
+    for (auto site = limitedSites.load(std::memory_order_acquire); site; site = site->next) {
+        if (!site->suppressed.load(std::memory_order_relaxed))
+            continue;
+        const auto last = site->lastEmitted.load(std::memory_order_relaxed);
+        if (!all && now - last < window)
+            continue;
+        if (const auto count = site->suppressed.exchange(0, std::memory_order_relaxed); count) {
+            site->lastEmitted.store(now, std::memory_order_relaxed);
+            summarize(*site, count, now - last, direct);
+        }
+    }
+}
+
+// Logs "suppressed 12,381 similar messages in last 5s (File.cpp:42)" on behalf of the site
+void Logger::summarize(const RateLimit::Summary& site, uint64_t count, uint64_t elapsed, bool direct) {
+    const std::string_view file = site.file;
+    const auto slash = file.find_last_of("/\\");
+    const auto seconds = std::max<uint64_t>((elapsed + 999999999) / 1000000000, 1);
+    Logger summary(site.file.c_str(), site.func.c_str(), site.line, site.level, site.component.c_str(),
+                   site.componentId);
+    summary.mDirect = direct;
+    summary << "suppressed " << groupDigits(count) << (count == 1 ? " similar message" : " similar messages")
+            << " in last " << seconds << "s (" << file.substr(slash == std::string_view::npos ? 0 : slash + 1)
+            << ':' << site.line << ')';
+}
+
+Logger::Logger(const char* fileName, const char* funcName, int lineNumber, Level level, const char* mgr,
+               int component, RateLimit* limit)
+    : mLevel(level), mComponent(mgr), mComponentId(component), mLimit(limit),
+      mTime(std::chrono::system_clock::now()), mContent(formatters.acquire()),
+      mText(static_cast<StringBuf*>(mContent.rdbuf())->text) {
+    if (mLimit)
+        mLimit->describe(fileName, funcName, lineNumber, level, mgr, component);
     if (mLevel >= lineLevel) {
         mFileName = fileName;
         mFuncName = funcName;
         mLineNumber = lineNumber;
     }
-    mContent << LColor::white << getTimeString('-', ' ', ':')
-        << '[' << mgr << ']';
+    mText.append(LColor::white).append(recordTime(mTime)).append(1, '[').append(mgr).append(1, ']');
     switch (level) {
     case Level::verbose:
-        mContent << LColor::white;
+        mText.append(LColor::white);
         break;
     case Level::debug:
-        mContent << LColor::white;
+        mText.append(LColor::white);
         break;
     case Level::info:
-        mContent << LColor::lwhite;
+        mText.append(LColor::lwhite);
         break;
     case Level::warning:
-        mContent << LColor::lyellow;
+        mText.append(LColor::lyellow);
         break;
     case Level::error:
-        mContent << LColor::lred;
+        mText.append(LColor::lred);
         break;
     case Level::fatal:
-        mContent << LColor::red;
+        mText.append(LColor::red);
         break;
     }
-    mContent << levelTags[static_cast<size_t>(level)];
+    mText.append(levelTags[static_cast<size_t>(level)]);
+    mMessageBegin = mText.size();
 }
 
-void Logger::writeOstream(std::ostream& ostream, bool noColor) const {
-    using namespace LColorFunc;
-    constexpr static char stylechar = '&';
-    static std::map<char, ColorFunc> cmap =
-    {
-        {'0', black}, {'1', red}, {'2', yellow}, {'3', green},
-        {'4', cyan}, {'5', blue}, {'6', magenta}, {'7', white},
-        {'8', lblack}, {'9', lred}, {'a', lyellow}, {'b', lgreen},
-        {'c', lcyan}, {'d', lblue}, {'e', lmagenta}, {'f', lwhite},
+void Logger::addField(std::string_view key, bool value) { putField(key, value ? "true" : "false", false); }
+
+void Logger::addField(std::string_view key, int64_t value) {
+    char buffer[24];
+    const auto end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+    putField(key, std::string_view(buffer, static_cast<size_t>(end - buffer)), false);
+}
+
+void Logger::addField(std::string_view key, uint64_t value) {
+    char buffer[24];
+    const auto end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+    putField(key, std::string_view(buffer, static_cast<size_t>(end - buffer)), false);
+}
+
+void Logger::addField(std::string_view key, double value) {
+    if (!std::isfinite(value)) {
+        putField(key, "null", false); // Not representable in JSON
+        return;
+    }
+    char buffer[32];
+    const auto end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+    putField(key, std::string_view(buffer, static_cast<size_t>(end - buffer)), false);
+}
+
+void Logger::addField(std::string_view key, std::string_view value) { putField(key, value, true); }
+
+// Appends `"key":value` to mFields, or leaves it unchanged if the field does not fit
+void Logger::putField(std::string_view key, std::string_view value, bool quoted) {
+    if (mFieldCount == maxFields)
+        return;
+    auto size = static_cast<size_t>(mFieldsSize);
+    bool fits = true;
+    const auto put = [&](const char* data, size_t length) {
+        if (!fits || length > fieldBytes - size) {
+            fits = false;
+            return;
+        }
+        std::memcpy(mFields.data() + size, data, length);
+        size += length;
     };
-    std::string str = mContent.str();
+    if (mFieldCount)
+        put(",", 1);
+    put("\"", 1);
+    const auto keyBegin = size;
+    escapeJson(key, put);
+    put("\":", 2);
+    const auto valueBegin = size;
+    if (quoted) {
+        put("\"", 1);
+        escapeJson(value, put);
+        put("\"", 1);
+    }
+    else
+        put(value.data(), value.size());
+    if (!fits)
+        return;
+    mKeyBegin[mFieldCount] = static_cast<uint16_t>(keyBegin);
+    mValueBegin[mFieldCount] = static_cast<uint16_t>(valueBegin);
+    ++mFieldCount;
+    mFieldsSize = static_cast<uint16_t>(size);
+}
+
+// Segment-wise writer for consoles that are colored through API calls rather than escape sequences
+void Logger::writeOstream(std::ostream& ostream, const std::string& str) {
+    constexpr static char stylechar = '&';
     std::string::size_type pos1 = 0, pos2 = str.find(stylechar);
     for (;;) {
-        if (std::string::npos == pos2) {
-            ostream << str.substr(pos1, str.size());
+        if (std::string::npos == pos2 || pos2 + 1 == str.size()) {
+            ostream.write(str.data() + pos1, str.size() - pos1);
             return;
         }
-        ostream << str.substr(pos1, pos2 - pos1);
-        if (pos2 < str.size()) {
-            char ch = str[pos2 + 1];
-            if (!noColor) {
-                ColorFunc cf = cmap[(ch >= 'A' && ch <= 'F') ? ch - 'A' + 'a' : ch];
-                if (cf)
-                    ostream << cf;
-                else {
-                    if (ch == stylechar) {
-                        ostream << stylechar; // Escaped to `stylechar`
-                    }
-                    else {
-                        ostream << stylechar << ch; // Wrong color code
-                    }
-                }
-            }
-        }
+        ostream.write(str.data() + pos1, pos2 - pos1);
+        const char ch = str[pos2 + 1];
+        if (const auto index = LColor::codeIndex(ch); index >= 0)
+            ostream << LColorFunc::byCode[index];
+        else if (ch == stylechar)
+            ostream << stylechar; // Escaped to `stylechar`
+        else
+            ostream << stylechar << ch; // Wrong color code
         pos1 = pos2 + 2;
         pos2 = str.find(stylechar, pos1);
     }
 }
 
 Logger::~Logger() {
+    finish();
+    formatters.release();
+}
+
+void Logger::finish() {
+    const auto messageEnd = mText.size();
+    // The fields also go into the text as ` key=value`, `&` doubled so that it is not taken for a color code
+    for (size_t i = 0; i < mFieldCount; ++i) {
+        const auto fieldEnd = i + 1 < mFieldCount ? mKeyBegin[i + 1] - 2u : mFieldsSize;
+        mText.push_back(' ');
+        mText.append(mFields.data() + mKeyBegin[i], mValueBegin[i] - 2u - mKeyBegin[i]);
+        mText.push_back('=');
+        for (auto j = mValueBegin[i]; j < fieldEnd; ++j) {
+            if (mFields[j] == '&')
+                mText.push_back('&');
+            mText.push_back(mFields[j]);
+        }
+    }
     if (mLevel >= lineLevel) {
-        mContent << std::endl
-            << "\tSource :\t" << mFileName << std::endl
-            << "\tAt Line :\t" << mLineNumber << std::endl
-            << "\tFunction :\t" << mFuncName << std::endl;
+        *this << "\n\tSource :\t" << mFileName << "\n\tAt Line :\t" << mLineNumber
+              << "\n\tFunction :\t" << mFuncName << '\n';
     }
-    mContent << std::endl;
-    if (!fileOnly) {
-        if (mLevel >= cerrLevel)
-            writeOstream(std::cerr);
-        else if (mLevel >= coutLevel)
-            writeOstream(std::cout);
+    mText.push_back('\n');
+    const auto& content = mText;
+    if (FlightRecorder::captures(mLevel)) {
+        FlightRecorder::record(content);
+        if (mLevel == Level::fatal)
+            FlightRecorder::dump("fatal record");
     }
-    if (mLevel >= fileLevel) {
-        for (auto& it : fsink) {
-            writeOstream(it, true);
-            if (mLevel >= cerrLevel)
-                it.flush();
+    if (static_cast<int>(mLevel) < componentOutputs[mComponentId].load(std::memory_order_relaxed))
+        return; // Only wanted by the FlightRecorder
+    if (mLimit) {
+        const auto now = RateLimit::clock();
+        if (mLimit->repeated(hashMessage(std::string_view(content).substr(mMessageBegin, messageEnd - mMessageBegin)),
+                             now)) {
+            mLimit->suppress();
+            return;
         }
+        const auto last = mLimit->mLastEmitted.exchange(now, std::memory_order_relaxed);
+        if (const auto summary = mLimit->mSummary.load(std::memory_order_acquire); summary) {
+            summary->lastEmitted.store(now, std::memory_order_relaxed);
+            if (const auto count = summary->suppressed.exchange(0, std::memory_order_relaxed); count)
+                summarize(*summary, count, now - last, false);
+        }
+    }
+    const RecordInfo info{
+        mComponent, mComponentId, threadId(), mTime, mMessageBegin, messageEnd, std::string_view(mFields.data(), mFieldsSize)
+    };
+    if (mDirect) {
+        std::lock_guard<std::mutex> lk(mutex);
+        writeRecord(mLevel, content, info);
+    }
+    else if (!backend.push(mLevel, content, info)) {
+        static auto lastIdle = std::chrono::steady_clock::now(); // Guarded by `mutex`
+        std::lock_guard<std::mutex> lk(mutex);
+        if (!writeRecord(mLevel, content, info))
+            return;
+        // Without the writer thread nobody calls idle(), so a buffering sink would hold the record until it gets
+        // another write over its threshold. Give them the writer's schedule instead; they flush when it is due
+        if (const auto now = std::chrono::steady_clock::now(); now - lastIdle >= std::chrono::milliseconds(100)) {
+            lastIdle = now;
+            for (auto& it : sinks)
+                it->idle();
+        }
+    }
+}
+
+bool Logger::writeRecord(Level level, const std::string& content, const RecordInfo& info) {
+    static Renderer renderer, message; // Guarded by `mutex`
+    static const auto outMode = consoleMode(stdout), errMode = consoleMode(stderr);
+    const bool toErr = level >= cerrLevel;
+    const bool toFile = level >= sinkLevel(info.componentId) && !sinks.empty();
+    bool toConsole = toErr || level >= consoleLevel(info.componentId);
+    auto& console = toErr ? std::cerr : std::cout;
+    const auto mode = toErr ? errMode : outMode;
+    if (toConsole && mode == ConsoleMode::legacy) {
+        writeOstream(console, content);
+        toConsole = false;
+    }
+    const bool colored = toConsole && mode == ConsoleMode::ansi;
+    renderer.render(content, colored, toFile || (toConsole && !colored));
+    if (toConsole) {
+        const auto& text = colored ? renderer.ansi() : renderer.plain();
+        console.write(text.data(), text.size());
+    }
+    if (toFile) {
+        message.render(std::string_view(content).substr(info.messageBegin, info.messageEnd - info.messageBegin),
+                       false, true);
+        const LogRecord record{
+            level, renderer.plain(), info.component, info.thread, info.time, message.plain(), info.fields
+        };
+        for (auto& it : sinks)
+            it->write(record);
     }
+    return toFile;
 }
@@ -0,0 +1,77 @@
+//
+// Core: Mailbox.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <memory>
+#include "Core/Mailbox.h"
+
+Mailbox::Queue::Queue() noexcept : mOwner(std::this_thread::get_id()), mHead(&mStub), mTail(&mStub) {}
+
+Mailbox::Queue::~Queue() {
+    while (const auto node = pop())
+        delete node;
+}
+
+size_t Mailbox::Queue::drain() {
+    // The newest task now is the last one to run; the stub there means the queue ends before it
+    const auto last = mHead.load(std::memory_order_acquire);
+    size_t ran = 0;
+    while (last != &mStub || mTail != &mStub) {
+        const auto node = pop();
+        if (!node)
+            break;
+        std::unique_ptr<Node> task(node);
+        ++ran;
+        task->run();
+        if (node == last)
+            break;
+    }
+    return ran;
+}
+
+void Mailbox::Queue::push(Node* node) noexcept {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    const auto prev = mHead.exchange(node, std::memory_order_acq_rel);
+    // Until this store the queue is cut between prev and node, and the owner sees it as empty beyond prev
+    prev->next.store(node, std::memory_order_release);
+}
+
+Mailbox::Queue::Node* Mailbox::Queue::pop() noexcept {
+    auto tail = mTail;
+    auto next = tail->next.load(std::memory_order_acquire);
+    if (tail == &mStub) {
+        if (!next)
+            return nullptr;
+        mTail = tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+        mTail = next;
+        return tail;
+    }
+    // tail is the last node unless a producer is between its two steps, in which case its task waits for the next pop
+    if (tail != mHead.load(std::memory_order_acquire))
+        return nullptr;
+    push(&mStub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        mTail = next;
+        return tail;
+    }
+    return nullptr;
+}
@@ -0,0 +1,218 @@
+//
+// Core: MappedSink.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include <stdexcept>
+#include <boost/predef/os.h>
+#include "Core/MappedSink.h"
+#include "Core/Filesystem.h"
+
+#if !(BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+struct MappedSink::Segment {
+    int file = -1;
+    char* base = nullptr;
+    size_t size = 0;
+    // Next free byte; may run past `size` once writers start failing
+    std::atomic<size_t> offset{0};
+    // Lowest failed reservation, everything below it has been written
+    std::atomic<size_t> limit{SIZE_MAX};
+    std::atomic<uint32_t> writers{0};
+
+    size_t written() const noexcept { return std::min({offset.load(), limit.load(), size}); }
+};
+
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+
+MappedSink::MappedSink(const std::string&, const std::string&, size_t) : mSegmentBytes(0) {
+    throw std::runtime_error("MappedSink is not supported on this platform");
+}
+
+MappedSink::~MappedSink() = default;
+
+void MappedSink::write(const LogRecord&) {}
+
+void MappedSink::flush() {}
+
+size_t MappedSink::segmentCount() const noexcept { return 0; }
+
+bool MappedSink::roll(Segment*) { return false; }
+
+bool MappedSink::open() { return false; }
+
+void MappedSink::close(Segment*) {}
+
+#else
+
+namespace {
+    std::string startupTime() {
+        const auto timer = std::time(nullptr);
+        tm currtime;
+        localtime_r(&timer, &currtime);
+        char buf[32];
+        std::strftime(buf, sizeof(buf), "%Y-%m-%d_%H-%M-%S", &currtime);
+        return buf;
+    }
+
+    void lowerTo(std::atomic<size_t>& value, size_t bound) noexcept {
+        auto cur = value.load();
+        while (bound < cur && !value.compare_exchange_weak(cur, bound)) {}
+    }
+}
+
+MappedSink::MappedSink(const std::string& path, const std::string& prefix, size_t segmentBytes)
+        : mBaseName(path + prefix + "_" + startupTime()), mSegmentBytes(segmentBytes),
+          mBroken(std::make_unique<Segment>()) {
+    filesystem::create_directory(path);
+    std::lock_guard<std::mutex> lk(mRoll);
+    if (!open())
+        throw std::runtime_error("Failed to create log segment " + mBaseName + ".0.log");
+}
+
+MappedSink::~MappedSink() {
+    std::lock_guard<std::mutex> lk(mRoll);
+    if (const auto seg = mCurrent.load(); seg != mBroken.get())
+        close(seg);
+}
+
+void MappedSink::write(const LogRecord& record) {
+    const auto length = record.text.size();
+    for (;;) {
+        const auto seg = mCurrent.load();
+        seg->writers.fetch_add(1);
+        // Pairs with the store in roll(): either we see the new segment, or roll() sees us as a writer
+        if (mCurrent.load() != seg) {
+            seg->writers.fetch_sub(1);
+            continue;
+        }
+        const auto start = seg->offset.fetch_add(length);
+        if (start + length <= seg->size) {
+            std::memcpy(seg->base + start, record.text.data(), length);
+            seg->writers.fetch_sub(1);
+            return;
+        }
+        lowerTo(seg->limit, start);
+        seg->writers.fetch_sub(1);
+        if (length > mSegmentBytes)
+            return; // Would not fit into any segment
+        if (!roll(seg)) {
+            mLost.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+void MappedSink::flush() {
+    // The data already is in the page cache, only ask for an early writeback
+    if (const auto seg = mCurrent.load(); seg->base)
+        msync(seg->base, seg->size, MS_ASYNC);
+}
+
+size_t MappedSink::segmentCount() const noexcept {
+    std::lock_guard<std::mutex> lk(mRoll);
+    return mOpened;
+}
+
+// Returns false if there is no segment to write to, while opening one fails
+bool MappedSink::roll(Segment* full) {
+    std::lock_guard<std::mutex> lk(mRoll);
+    if (mCurrent.load() != full)
+        return true; // Somebody else rolled already
+    const auto now = std::chrono::steady_clock::now();
+    if (full == mBroken.get() && now < mRetry)
+        return false;
+    const bool opened = open();
+    if (!opened) {
+        mRetry = now + std::chrono::seconds(1);
+        mCurrent.store(mBroken.get());
+    }
+    if (full != mBroken.get())
+        close(full);
+    return opened;
+}
+
+// Caller holds mRoll. Reports a failure once, until a segment is opened again
+bool MappedSink::open() {
+    if (mSpare.empty()) {
+        mSegments.push_back(std::make_unique<Segment>());
+        mSpare.push_back(mSegments.back().get());
+    }
+    const auto seg = mSpare.back();
+    const auto name = mBaseName + "." + std::to_string(mOpened) + ".log";
+    // `writers` is left alone: a writer that saw this segment before it was closed may not have backed off yet
+    seg->size = mSegmentBytes;
+    seg->offset.store(0);
+    seg->limit.store(SIZE_MAX);
+    seg->file = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int error = errno;
+    void* base = MAP_FAILED;
+    if (seg->file >= 0) {
+#if BOOST_OS_LINUX
+        // Returns the error rather than setting errno
+        error = posix_fallocate(seg->file, 0, static_cast<off_t>(seg->size));
+#else
+        error = ftruncate(seg->file, static_cast<off_t>(seg->size)) == 0 ? 0 : errno;
+#endif
+        if (!error && (base = mmap(nullptr, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->file, 0)) == MAP_FAILED)
+            error = errno;
+        if (base == MAP_FAILED) {
+            ::close(seg->file);
+            seg->file = -1;
+            ::unlink(name.c_str());
+        }
+    }
+    if (base == MAP_FAILED) {
+        if (!mFailed)
+            std::fprintf(stderr, "MappedSink: cannot create %s: %s\n", name.c_str(), std::strerror(error));
+        mFailed = true;
+        return false;
+    }
+    mFailed = false;
+    seg->base = static_cast<char*>(base);
+    mSpare.pop_back();
+    ++mOpened;
+    mCurrent.store(seg);
+    return true;
+}
+
+// Waits for the writers still copying into `seg`, then cuts the file down to what was written.
+// Caller holds mRoll and has already replaced `seg` as the current segment (or is shutting down)
+void MappedSink::close(Segment* seg) {
+    while (seg->writers.load())
+        std::this_thread::yield();
+    munmap(seg->base, seg->size);
+    if (ftruncate(seg->file, static_cast<off_t>(seg->written())) != 0) {
+        // Keep the zero-filled tail, readers have to cope with it after a crash anyway
+    }
+    ::close(seg->file);
+    seg->file = -1;
+    seg->base = nullptr;
+    mSpare.push_back(seg);
+}
+
+#endif
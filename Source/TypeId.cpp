@@ -0,0 +1,30 @@
+//
+// Core: TypeId.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <mutex>
+#include <typeindex>
+#include <unordered_map>
+#include "Core/TypeId.h"
+
+size_t registerTypeId(const std::type_info& type) {
+    static std::mutex lock;
+    static std::unordered_map<std::type_index, size_t> ids;
+    std::lock_guard<std::mutex> lk(lock);
+    return ids.emplace(type, ids.size()).first->second;
+}
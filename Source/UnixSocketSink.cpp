@@ -0,0 +1,237 @@
+//
+// Core: UnixSocketSink.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/predef/os.h>
+#include "Core/UnixSocketSink.h"
+
+#if !(BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+UnixSocketSink::UnixSocketSink(const std::string& path) : UnixSocketSink(path, Options()) {}
+
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+
+UnixSocketSink::UnixSocketSink(const std::string&, Options options) : mOptions(options) {
+    throw std::runtime_error("UnixSocketSink is not supported on this platform");
+}
+
+UnixSocketSink::~UnixSocketSink() = default;
+
+void UnixSocketSink::write(const LogRecord&) {}
+
+void UnixSocketSink::flush() {}
+
+void UnixSocketSink::idle() {}
+
+UnixSocketSink::Stats UnixSocketSink::stats() const noexcept { return {}; }
+
+void UnixSocketSink::send() {}
+
+bool UnixSocketSink::connect() { return false; }
+
+void UnixSocketSink::disconnect() {}
+
+bool UnixSocketSink::spill(size_t) { return false; }
+
+void UnixSocketSink::consume() {}
+
+#else
+
+namespace {
+    constexpr size_t headerBytes = 5;
+
+    uint32_t frameLength(const char* frame) noexcept {
+        const auto bytes = reinterpret_cast<const unsigned char*>(frame);
+        return uint32_t(bytes[0]) << 24u | uint32_t(bytes[1]) << 16u | uint32_t(bytes[2]) << 8u | bytes[3];
+    }
+
+#if BOOST_OS_LINUX
+    constexpr int sendFlags = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+    constexpr int sendFlags = MSG_DONTWAIT;
+#endif
+}
+
+UnixSocketSink::UnixSocketSink(const std::string& path, Options options)
+        : mPath(path), mOptions(options), mRetryDelay(options.reconnectMin) {
+    if (path.size() >= sizeof(sockaddr_un::sun_path))
+        throw std::runtime_error("Socket path is too long: " + path);
+    // The collector may come up later, records are kept until it does
+    connect();
+}
+
+UnixSocketSink::~UnixSocketSink() {
+    // Give the collector a short while to take the rest, the process is likely about to exit
+    const auto deadline = Clock::now() + std::chrono::milliseconds(200);
+    for (send(); mSocket >= 0 && mBegin < mBuffer.size() && Clock::now() < deadline; send()) {
+        pollfd fd{mSocket, POLLOUT, 0};
+        poll(&fd, 1, 20);
+    }
+    disconnect();
+}
+
+void UnixSocketSink::write(const LogRecord& record) {
+    const auto size = headerBytes + record.text.size();
+    if (size - 4 > UINT32_MAX || !spill(size)) {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (mBegin == mBuffer.size())
+        mOldest = Clock::now();
+    const auto length = static_cast<uint32_t>(size - 4);
+    const char header[headerBytes] = {
+        static_cast<char>(length >> 24u), static_cast<char>(length >> 16u), static_cast<char>(length >> 8u),
+        static_cast<char>(length), static_cast<char>(record.level)
+    };
+    mBuffer.append(header, headerBytes);
+    mBuffer.append(record.text);
+    if (mBuffer.size() - mBegin >= mOptions.batchBytes || record.level >= mOptions.flushLevel)
+        send();
+}
+
+void UnixSocketSink::flush() { send(); }
+
+void UnixSocketSink::idle() {
+    if (mBegin < mBuffer.size() && Clock::now() - mOldest >= mOptions.flushInterval) {
+        send();
+        mOldest = Clock::now();
+    }
+}
+
+UnixSocketSink::Stats UnixSocketSink::stats() const noexcept {
+    return {
+        mFrames.load(std::memory_order_relaxed), mBytes.load(std::memory_order_relaxed),
+        mDropped.load(std::memory_order_relaxed), mConnects.load(std::memory_order_relaxed), mSocket.load() >= 0
+    };
+}
+
+void UnixSocketSink::send() {
+    if (mSocket < 0 && (Clock::now() < mRetryAt || !connect()))
+        return;
+    while (mBegin + mSent < mBuffer.size()) {
+        const auto done = ::send(mSocket, mBuffer.data() + mBegin + mSent, mBuffer.size() - mBegin - mSent, sendFlags);
+        if (done > 0) {
+            mSent += static_cast<size_t>(done);
+            mBytes.fetch_add(static_cast<uint64_t>(done), std::memory_order_relaxed);
+        }
+        else if (done < 0 && errno == EINTR)
+            continue;
+        else {
+            // A full socket buffer just means the collector is behind, anything else means it is gone
+            if (done == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                disconnect();
+            break;
+        }
+    }
+    consume();
+}
+
+bool UnixSocketSink::connect() {
+    const auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#if !BOOST_OS_LINUX
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, mPath.c_str(), mPath.size() + 1);
+        // A pending connection is used like an established one, sends fail with EAGAIN until it completes
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 || errno == EINPROGRESS) {
+            mSocket = fd;
+            mRetryDelay = mOptions.reconnectMin;
+            mConnects.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        ::close(fd);
+    }
+    mRetryAt = Clock::now() + mRetryDelay;
+    mRetryDelay = std::min(mRetryDelay * 2, mOptions.reconnectMax);
+    return false;
+}
+
+void UnixSocketSink::disconnect() {
+    if (mSocket < 0)
+        return;
+    ::close(mSocket);
+    mSocket = -1;
+    // The collector throws away a frame it only got part of, so it is sent again from its start
+    consume();
+    mSent = 0;
+    mRetryAt = Clock::now() + mRetryDelay;
+    mRetryDelay = std::min(mRetryDelay * 2, mOptions.reconnectMax);
+}
+
+bool UnixSocketSink::spill(size_t incoming) {
+    auto queued = mBuffer.size() - mBegin;
+    if (queued + incoming <= mOptions.spillBytes)
+        return true;
+    // The frame on the wire has to be finished, the dropping starts after it
+    const size_t onWire = mSent ? 4 + frameLength(mBuffer.data() + mBegin) : 0;
+    if (onWire + incoming > mOptions.spillBytes)
+        return false;
+    const auto from = mBegin + onWire;
+    auto to = from;
+    while (queued + incoming > mOptions.spillBytes) {
+        const size_t size = 4 + frameLength(mBuffer.data() + to);
+        to += size;
+        queued -= size;
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (onWire)
+        mBuffer.erase(from, to - from);
+    else {
+        mBegin = to;
+        consume();
+    }
+    return true;
+}
+
+void UnixSocketSink::consume() {
+    while (mBuffer.size() - mBegin >= headerBytes) {
+        const size_t size = 4 + frameLength(mBuffer.data() + mBegin);
+        if (size > mSent)
+            break;
+        mBegin += size;
+        mSent -= size;
+        mFrames.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Sent frames are erased in bulk rather than one by one
+    if (mBegin == mBuffer.size()) {
+        mBuffer.clear();
+        mBegin = 0;
+    }
+    else if (mBegin >= 64 * 1024 && mBegin * 2 >= mBuffer.size()) {
+        mBuffer.erase(0, mBegin);
+        mBegin = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,117 @@
+//
+// Core: WorkerPool.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include "Core/WorkerPool.h"
+
+namespace {
+    // Shared by the calling thread and the helpers of one parallelFor; a helper that starts after the work is
+    // done finds no index left and only drops its reference
+    struct ParallelJob {
+        std::function<void(size_t)> fn;
+        size_t count;
+        std::atomic<size_t> next{0}, done{0};
+        std::exception_ptr error;
+        std::mutex lock;
+        std::condition_variable finished;
+
+        void work() {
+            size_t ran = 0;
+            for (auto i = next.fetch_add(1); i < count; i = next.fetch_add(1), ++ran) {
+                try {
+                    fn(i);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lk(lock);
+                    if (!error)
+                        error = std::current_exception();
+                }
+            }
+            if (ran && done.fetch_add(ran) + ran == count) {
+                std::lock_guard<std::mutex> lk(lock);
+                finished.notify_all();
+            }
+        }
+    };
+}
+
+WorkerPool::WorkerPool(size_t threads) {
+    if (!threads)
+        threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    mThreads.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+        mThreads.emplace_back([this]() { run(); });
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        mExit = true;
+    }
+    mWake.notify_all();
+    for (auto& x : mThreads)
+        x.join();
+}
+
+void WorkerPool::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        mTasks.push_back(std::move(task));
+    }
+    mWake.notify_one();
+}
+
+void WorkerPool::parallelFor(size_t count, const std::function<void(size_t)>& fn) {
+    if (!count)
+        return;
+    const auto job = std::make_shared<ParallelJob>();
+    job->fn = fn;
+    job->count = count;
+    const auto helpers = std::min(count - 1, size());
+    for (size_t i = 0; i < helpers; ++i)
+        post([job]() { job->work(); });
+    job->work();
+    std::unique_lock<std::mutex> lk(job->lock);
+    job->finished.wait(lk, [&]() { return job->done.load() == count; });
+    if (job->error)
+        std::rethrow_exception(job->error);
+}
+
+WorkerPool& WorkerPool::shared() {
+    static WorkerPool pool;
+    return pool;
+}
+
+void WorkerPool::run() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lk(mLock);
+            mWake.wait(lk, [this]() { return mExit || !mTasks.empty(); });
+            if (mTasks.empty())
+                return;
+            task = std::move(mTasks.front());
+            mTasks.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,145 @@
+//
+// Tools: LogCollector.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// A minimal local collector for UnixSocketSink: accepts any number of clients on a Unix domain socket
+// and writes the text of every complete frame to stdout or a file
+
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <boost/predef/os.h>
+#include "Core/Application.h"
+
+#if !(BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace {
+    CmdOption output {{"output", {"-o", "--output"}, "append the records to a file instead of stdout", 1}};
+    CmdOption minLevel {{"level", {"-l", "--level"}, "drop records below this level (0 = verbose ... 5 = fatal)", 1}};
+
+#if !(BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+    // Bytes received from one client; frames are taken off the front once complete
+    struct Client {
+        int socket;
+        std::string pending;
+    };
+
+    uint32_t frameLength(const char* frame) noexcept {
+        const auto bytes = reinterpret_cast<const unsigned char*>(frame);
+        return uint32_t(bytes[0]) << 24u | uint32_t(bytes[1]) << 16u | uint32_t(bytes[2]) << 8u | bytes[3];
+    }
+
+    int listenOn(const std::string& path) {
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path))
+            throw std::runtime_error("Socket path is too long: " + path);
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        const auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            throw std::runtime_error(std::string("Cannot create socket: ") + std::strerror(errno));
+        // A socket file left behind by a previous run would make bind fail
+        unlink(path.c_str());
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 16) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot listen on " + path + ": " + std::strerror(errno));
+        }
+        return fd;
+    }
+
+    // Writes the complete frames of a client, returns false if it sent something that is not a frame
+    bool drain(Client& client, std::ostream& out, int level) {
+        size_t pos = 0;
+        while (client.pending.size() - pos >= 4) {
+            const auto length = frameLength(client.pending.data() + pos);
+            if (!length)
+                return false;
+            if (client.pending.size() - pos - 4 < length)
+                break;
+            if (client.pending[pos + 4] >= level)
+                out.write(client.pending.data() + pos + 5, length - 1);
+            pos += 4 + length;
+        }
+        client.pending.erase(0, pos);
+        out.flush();
+        return true;
+    }
+#endif
+}
+
+class LogCollector : public Application {
+public:
+    void run() override {
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+        throw std::runtime_error("LogCollector is not supported on this platform");
+#else
+        auto& args = Application::args();
+        if (args.pos.size() != 1)
+            throw std::runtime_error("Usage: LogCollector [options] SOCKET");
+        const auto level = args.has_option("level") ? args["level"].as<int>() : 0;
+        std::ofstream file;
+        if (args.has_option("output"))
+            file.open(args["output"].as<std::string>(), std::ios::app | std::ios::binary);
+        auto& out = file.is_open() ? static_cast<std::ostream&>(file) : std::cout;
+
+        const auto server = listenOn(args.pos[0]);
+        std::vector<Client> clients;
+        std::vector<pollfd> fds;
+        char buffer[64 * 1024];
+        for (;;) {
+            fds.assign(1, {server, POLLIN, 0});
+            for (auto& x : clients)
+                fds.push_back({x.socket, POLLIN, 0});
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+            }
+            // Clients first, a new one is only added to the poll set in the next round
+            for (size_t i = clients.size(); i-- > 0;) {
+                if (!fds[i + 1].revents)
+                    continue;
+                auto& client = clients[i];
+                const auto got = recv(client.socket, buffer, sizeof(buffer), 0);
+                if (got > 0)
+                    client.pending.append(buffer, static_cast<size_t>(got));
+                if (got > 0 && drain(client, out, level))
+                    continue;
+                if (got < 0 && errno == EINTR)
+                    continue;
+                // Disconnected or garbled: a partial frame at the end is discarded, the sender sends it again
+                close(client.socket);
+                clients.erase(clients.begin() + static_cast<ptrdiff_t>(i));
+            }
+            if (fds[0].revents & POLLIN)
+                if (const auto fd = accept(server, nullptr, nullptr); fd >= 0)
+                    clients.push_back({fd, {}});
+        }
+#endif
+    }
+};
+
+DECL_APPLICATION(LogCollector)
@@ -0,0 +1,263 @@
+//
+// Tools: LogDecoder.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Turns a log written through BinaryLog into the text format produced by Logger
+
+#include <ctime>
+#include <vector>
+#include <cstring>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <unordered_map>
+#include "Core/Application.h"
+#include "Core/BinaryLog.h"
+
+namespace {
+    CmdOption output {{"output", {"-o", "--output"}, "write the decoded text to a file instead of stdout", 1}};
+    CmdOption sort {{"sort", {"-s", "--sort"}, "order the records of all threads by time", 0}};
+
+    constexpr const char* levelTags[] = {"[verbose]", "[debug]", "[info]", "[warning]", "[error]", "[fatal]"};
+
+    struct SiteInfo {
+        uint8_t level = 0;
+        uint32_t line = 0;
+        std::vector<BinaryLog::ArgType> types;
+        std::string file, func, component, format;
+    };
+
+    struct Record {
+        uint64_t time;
+        std::string text;
+    };
+
+    class Reader {
+    public:
+        explicit Reader(std::string data) : mData(std::move(data)) {}
+
+        bool done() const noexcept { return mPos >= mData.size(); }
+
+        template <class T>
+        T get() {
+            T ret;
+            need(sizeof(T));
+            std::memcpy(&ret, mData.data() + mPos, sizeof(T));
+            mPos += sizeof(T);
+            return ret;
+        }
+
+        std::string bytes(size_t length) {
+            need(length);
+            auto ret = mData.substr(mPos, length);
+            mPos += length;
+            return ret;
+        }
+
+        std::string shortString() { return bytes(get<uint16_t>()); }
+    private:
+        void need(size_t length) const {
+            if (mPos + length > mData.size())
+                throw std::runtime_error("Unexpected end of binary log");
+        }
+
+        std::string mData;
+        size_t mPos = 0;
+    };
+
+    std::string timeString(uint64_t ns) {
+        const auto timer = static_cast<time_t>(ns / 1000000000u);
+        tm currtime;
+#if BOOST_COMP_MSVC
+        localtime_s(&currtime, &timer);
+#else
+        localtime_r(&timer, &currtime);
+#endif
+        char buf[32];
+        std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &currtime);
+        return buf;
+    }
+
+    std::string argument(Reader& in, BinaryLog::ArgType type) {
+        using BinaryLog::ArgType;
+        switch (type) {
+        case ArgType::boolean:
+            return in.get<uint8_t>() ? "true" : "false";
+        case ArgType::character:
+            return std::string(1, static_cast<char>(in.get<uint8_t>()));
+        case ArgType::i32:
+            return std::to_string(in.get<int32_t>());
+        case ArgType::u32:
+            return std::to_string(in.get<uint32_t>());
+        case ArgType::i64:
+            return std::to_string(in.get<int64_t>());
+        case ArgType::u64:
+            return std::to_string(in.get<uint64_t>());
+        case ArgType::f64: {
+            std::ostringstream ss;
+            ss << in.get<double>();
+            return ss.str();
+        }
+        case ArgType::string:
+            return in.bytes(in.get<uint32_t>());
+        case ArgType::pointer: {
+            std::ostringstream ss;
+            ss << "0x" << std::hex << in.get<uint64_t>();
+            return ss.str();
+        }
+        }
+        throw std::runtime_error("Unknown argument type in binary log");
+    }
+
+    // An integer argument as LogFormat prints it for `{x}`: lowercase hexadecimal of its own width, no prefix.
+    // Other arguments are printed as for `{}`
+    std::string hex(const std::string& text, BinaryLog::ArgType type) {
+        using BinaryLog::ArgType;
+        uint64_t value;
+        switch (type) {
+        case ArgType::character:
+            value = static_cast<unsigned char>(text[0]);
+            break;
+        case ArgType::i32:
+            value = static_cast<uint32_t>(std::stol(text));
+            break;
+        case ArgType::i64:
+            value = static_cast<uint64_t>(std::stoll(text));
+            break;
+        case ArgType::u32:
+        case ArgType::u64:
+            value = std::stoull(text);
+            break;
+        default:
+            return text;
+        }
+        std::ostringstream ss;
+        ss << std::hex << value;
+        return ss.str();
+    }
+
+    // Substitutes `{}` and `{x}` in order, `{{` and `}}` are escapes. Arguments without a placeholder are appended
+    std::string render(const std::string& format, const std::vector<std::string>& args,
+                       const std::vector<BinaryLog::ArgType>& types) {
+        std::string ret;
+        size_t next = 0;
+        for (size_t i = 0; i < format.size(); ++i) {
+            if (format[i] == '{' && i + 1 < format.size() && format[i + 1] == '}') {
+                ret += next < args.size() ? args[next++] : "{}";
+                ++i;
+            }
+            else if (format.compare(i, 3, "{x}") == 0) {
+                ret += next < args.size() ? hex(args[next], types[next]) : "{x}";
+                next += next < args.size();
+                i += 2;
+            }
+            else if ((format[i] == '{' || format[i] == '}') && i + 1 < format.size() && format[i + 1] == format[i]) {
+                ret += format[i];
+                ++i;
+            }
+            else
+                ret += format[i];
+        }
+        for (; next < args.size(); ++next)
+            ret += ' ' + args[next];
+        return ret;
+    }
+
+    std::vector<Record> decode(Reader& in) {
+        if (in.bytes(sizeof(BinaryLog::magic)) != std::string(BinaryLog::magic, sizeof(BinaryLog::magic)))
+            throw std::runtime_error("Not a binary log");
+        if (const auto ver = in.get<uint32_t>(); ver != BinaryLog::version)
+            throw std::runtime_error("Unsupported binary log version " + std::to_string(ver));
+        std::unordered_map<uint32_t, SiteInfo> sites;
+        std::vector<Record> records;
+        while (!in.done()) {
+            switch (static_cast<BinaryLog::Entry>(in.get<uint8_t>())) {
+            case BinaryLog::Entry::site: {
+                const auto id = in.get<uint32_t>();
+                auto& site = sites[id];
+                site.level = in.get<uint8_t>();
+                site.line = in.get<uint32_t>();
+                site.types.resize(in.get<uint8_t>());
+                for (auto& x : site.types)
+                    x = static_cast<BinaryLog::ArgType>(in.get<uint8_t>());
+                site.file = in.shortString();
+                site.func = in.shortString();
+                site.component = in.shortString();
+                site.format = in.shortString();
+                break;
+            }
+            case BinaryLog::Entry::chunk: {
+                in.get<uint64_t>(); // Writing thread, records are already grouped by it
+                Reader chunk(in.bytes(in.get<uint32_t>()));
+                while (!chunk.done()) {
+                    const auto id = chunk.get<uint32_t>();
+                    const auto time = chunk.get<uint64_t>();
+                    const auto it = sites.find(id);
+                    if (it == sites.end())
+                        throw std::runtime_error("Record refers to unknown site " + std::to_string(id));
+                    const auto& site = it->second;
+                    std::vector<std::string> args;
+                    for (auto x : site.types)
+                        args.push_back(argument(chunk, x));
+                    auto text = timeString(time) + '[' + site.component + ']' +
+                                levelTags[std::min<size_t>(site.level, 5)] + render(site.format, args, site.types) + '\n';
+                    if (site.level >= static_cast<uint8_t>(Logger::Level::error))
+                        text += "\tSource :\t" + site.file + "\n\tAt Line :\t" + std::to_string(site.line) +
+                                "\n\tFunction :\t" + site.func + "\n";
+                    records.push_back({time, std::move(text)});
+                }
+                break;
+            }
+            default:
+                throw std::runtime_error("Corrupted binary log");
+            }
+        }
+        return records;
+    }
+}
+
+class LogDecoder : public Application {
+public:
+    void run() override {
+        auto& args = Application::args();
+        if (args.pos.empty())
+            throw std::runtime_error("Usage: LogDecoder [options] FILE [FILE...]");
+        std::vector<Record> records;
+        for (auto name : args.pos) {
+            std::ifstream file(name, std::ios::binary);
+            if (!file)
+                throw std::runtime_error(std::string("Cannot open ") + name);
+            Reader in({std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()});
+            auto decoded = decode(in);
+            std::move(decoded.begin(), decoded.end(), std::back_inserter(records));
+        }
+        if (args.has_option("sort"))
+            std::stable_sort(records.begin(), records.end(),
+                             [](const Record& l, const Record& r) { return l.time < r.time; });
+        std::ofstream file;
+        if (args.has_option("output"))
+            file.open(args["output"].as<std::string>());
+        auto& out = file.is_open() ? static_cast<std::ostream&>(file) : std::cout;
+        for (auto& x : records)
+            out << x.text;
+    }
+};
+
+DECL_APPLICATION(LogDecoder)
@@ -0,0 +1,286 @@
+//
+// Tools: LoggerBenchmark.cpp
+// NEWorld: A Free Game with Similar Rules to Minecraft.
+// Copyright (C) 2015-2018 NEWorld Team
+//
+// NEWorld is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// NEWorld is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+// or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General
+// Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with NEWorld.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Measures the cost of a log statement for every sink and logging mode at 1 to N producer threads,
+// and prints the throughput and the latency percentiles of a single call as JSON
+
+#ifndef NW_COMPONENT_NAME
+#define NW_COMPONENT_NAME "Benchmark"
+#endif
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <boost/predef/os.h>
+#include "Core/Application.h"
+#include "Core/BinaryLog.h"
+#include "Core/FileSink.h"
+#include "Core/JsonHelper.h"
+#include "Core/JsonLineSink.h"
+#include "Core/LogFormat.h"
+#include "Core/Logger.h"
+#include "Core/MappedSink.h"
+
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    CmdOption output {{"output", {"-o", "--output"}, "write the results to a file instead of stdout", 1}};
+    CmdOption threads {{"threads", {"-t", "--threads"}, "highest number of producer threads (default: cores)", 1}};
+    CmdOption records {{"records", {"-n", "--records"}, "records logged by each thread (default: 100000)", 1}};
+    CmdOption directory {{"directory", {"-d", "--directory"}, "where the file sinks write (default: ./bench/)", 1}};
+    CmdOption filter {{"filter", {"-f", "--filter"}, "only run the cases whose name contains this", 1}};
+
+    using Clock = std::chrono::steady_clock;
+
+    enum class Api { stream, format, binary };
+
+    constexpr const char* apiNames[] = {"stream", "format", "binary"};
+
+    struct Case {
+        std::string sink;
+        bool async;
+        Api api;
+        // Attaches the sink and sets the levels; returns the sink to remove afterwards, if any
+        std::function<LogSink*()> setUp;
+
+        std::string name() const { return sink + '/' + (async ? "async" : "sync") + '/' + apiNames[int(api)]; }
+    };
+
+    // Sends stdout to the null device while it is alive, so that the console case measures the Logger
+    class NullStdout {
+    public:
+        NullStdout() {
+            std::cout.flush();
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+            mSaved = _dup(1);
+            const auto null = _open("NUL", _O_WRONLY);
+            _dup2(null, 1);
+            _close(null);
+#else
+            mSaved = dup(1);
+            const auto null = open("/dev/null", O_WRONLY);
+            dup2(null, 1);
+            close(null);
+#endif
+        }
+
+        ~NullStdout() {
+            std::cout.flush();
+#if (BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+            _dup2(mSaved, 1);
+            _close(mSaved);
+#else
+            dup2(mSaved, 1);
+            close(mSaved);
+#endif
+        }
+    private:
+        int mSaved;
+    };
+
+    void logOnce(Api api, Logger::Level level, uint64_t i) {
+        // Disabled cases log at verbose, below every output
+        if (level == Logger::Level::verbose) {
+            switch (api) {
+            case Api::stream: verbosestream << "chunk " << i << " loaded in " << 1.25 << "ms"; break;
+            case Api::format: verboselog("chunk {} loaded in {}ms", i, 1.25); break;
+            case Api::binary: verbosebinary("chunk {} loaded in {}ms", i, 1.25); break;
+            }
+            return;
+        }
+        switch (api) {
+        case Api::stream: infostream << "chunk " << i << " loaded in " << 1.25 << "ms"; break;
+        case Api::format: infolog("chunk {} loaded in {}ms", i, 1.25); break;
+        case Api::binary: infobinary("chunk {} loaded in {}ms", i, 1.25); break;
+        }
+    }
+
+    // Nearest-rank percentile of sorted samples
+    uint64_t percentile(const std::vector<uint32_t>& sorted, double p) {
+        if (sorted.empty())
+            return 0;
+        const auto rank = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[std::min(rank, sorted.size() - 1)];
+    }
+
+    Json runCase(const Case& test, Logger::Level level, size_t threadCount, size_t count) {
+        std::unique_ptr<NullStdout> console;
+        if (test.sink == "console")
+            console = std::make_unique<NullStdout>();
+        const auto sink = test.setUp();
+        if (test.async)
+            Logger::enableAsync();
+        const auto droppedBefore = Logger::droppedCount();
+
+        std::vector<std::vector<uint32_t>> latencies(threadCount, std::vector<uint32_t>(count));
+        std::atomic<size_t> ready{0};
+        std::atomic_bool go{false};
+        std::vector<std::thread> producers;
+        for (size_t t = 0; t < threadCount; ++t)
+            producers.emplace_back([&, t]() {
+                auto& samples = latencies[t];
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire))
+                    std::this_thread::yield();
+                for (size_t i = 0; i < count; ++i) {
+                    const auto begin = Clock::now();
+                    logOnce(test.api, level, i);
+                    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin);
+                    samples[i] = static_cast<uint32_t>(std::min<int64_t>(ns.count(), UINT32_MAX));
+                }
+            });
+        while (ready.load() < threadCount)
+            std::this_thread::yield();
+        const auto begin = Clock::now();
+        go.store(true, std::memory_order_release);
+        for (auto& x : producers)
+            x.join();
+        const auto produced = Clock::now();
+        // Records per second includes getting everything to the sink, the latency only covers the call
+        Logger::flush();
+        if (test.api == Api::binary)
+            BinaryLog::flush();
+        const auto written = Clock::now();
+
+        const auto dropped = Logger::droppedCount() - droppedBefore;
+        if (test.async)
+            Logger::disableAsync();
+        if (test.api == Api::binary)
+            BinaryLog::close();
+        if (sink)
+            Logger::removeSink(sink);
+        console.reset();
+
+        std::vector<uint32_t> all;
+        all.reserve(threadCount * count);
+        for (auto& x : latencies)
+            all.insert(all.end(), x.begin(), x.end());
+        std::sort(all.begin(), all.end());
+        const auto total = static_cast<double>(threadCount * count);
+        const auto seconds = [](Clock::duration d) { return std::chrono::duration<double>(d).count(); };
+        uint64_t sum = 0;
+        for (auto x : all)
+            sum += x;
+        return {
+                {"sink", test.sink}, {"mode", test.async ? "async" : "sync"}, {"api", apiNames[int(test.api)]},
+                {"threads", threadCount},
+                {"nsPerRecord", static_cast<double>(sum) / total},
+                {"recordsPerSecond", total / seconds(written - begin)},
+                {"producerSeconds", seconds(produced - begin)},
+                {"flushSeconds", seconds(written - produced)},
+                {"dropped", dropped},
+                {"latencyNs", {{"p50", percentile(all, 0.5)}, {"p99", percentile(all, 0.99)},
+                               {"p999", percentile(all, 0.999)}, {"max", all.empty() ? 0 : all.back()}}}
+        };
+    }
+
+    std::vector<Case> cases(const std::string& dir) {
+        using Level = Logger::Level;
+        // Only the sink of the case gets info records; errors would also be echoed to stderr
+        const auto toSink = [](std::unique_ptr<LogSink> sink) {
+            Logger::setLevels(Level::fatal, Level::fatal, Level::info, Level::fatal);
+            return Logger::addSink(std::move(sink));
+        };
+        std::vector<Case> ret;
+        for (const auto async : {false, true}) {
+            for (const auto api : {Api::stream, Api::format}) {
+                ret.push_back({"disabled", async, api, []() -> LogSink* {
+                    Logger::setLevels(Level::fatal, Level::fatal, Level::fatal, Level::fatal);
+                    return nullptr;
+                }});
+                ret.push_back({"console", async, api, []() -> LogSink* {
+                    Logger::setLevels(Level::info, Level::fatal, Level::fatal, Level::fatal);
+                    return nullptr;
+                }});
+                ret.push_back({"file", async, api, [=]() {
+                    return toSink(std::make_unique<FileSink>(dir + "file.log"));
+                }});
+                ret.push_back({"jsonl", async, api, [=]() {
+                    return toSink(std::make_unique<JsonLineSink>(dir + "records.jsonl"));
+                }});
+#if !(BOOST_OS_CYGWIN || BOOST_OS_WINDOWS)
+                ret.push_back({"mapped", async, api, [=]() {
+                    return toSink(std::make_unique<MappedSink>(dir, "mapped"));
+                }});
+#endif
+            }
+        }
+        // Deferred formatting bypasses the sinks and the asynchronous writer
+        ret.push_back({"binary", false, Api::binary, [=]() -> LogSink* {
+            Logger::setLevels(Level::info, Level::fatal, Level::fatal, Level::fatal);
+            if (!BinaryLog::open(dir + "records.nwbl"))
+                throw std::runtime_error("Cannot open " + dir + "records.nwbl");
+            return nullptr;
+        }});
+        return ret;
+    }
+}
+
+class LoggerBenchmark : public Application {
+public:
+    void run() override {
+        auto& args = Application::args();
+        const size_t maxThreads = args.has_option("threads") ? args["threads"].as<size_t>() :
+                                  std::max(1u, std::thread::hardware_concurrency());
+        const size_t count = args.has_option("records") ? args["records"].as<size_t>() : 100000;
+        auto dir = args.has_option("directory") ? args["directory"].as<std::string>() : std::string("./bench/");
+        if (dir.back() != '/' && dir.back() != '\\')
+            dir += '/';
+        const auto only = args.has_option("filter") ? args["filter"].as<std::string>() : std::string();
+        filesystem::create_directories(dir);
+
+        Json results = Json::array();
+        for (auto& test : cases(dir)) {
+            if (test.name().find(only) == std::string::npos)
+                continue;
+            const auto level = test.sink == "disabled" ? Logger::Level::verbose : Logger::Level::info;
+            for (size_t threadCount = 1;; threadCount = std::min(threadCount * 2, maxThreads)) {
+                std::cerr << test.name() << " x" << threadCount << std::endl;
+                results.push_back(runCase(test, level, threadCount, count));
+                // The files of a case are only kept until the next one, so that long runs do not fill the disk
+                for (auto& x : filesystem::directory_iterator(dir))
+                    filesystem::remove_all(x.path());
+                if (threadCount == maxThreads)
+                    break;
+            }
+        }
+
+        const Json report = {
+                {"recordsPerThread", count}, {"maxThreads", maxThreads},
+                {"hardwareThreads", std::thread::hardware_concurrency()}, {"results", results}
+        };
+        std::ofstream file;
+        if (args.has_option("output"))
+            file.open(args["output"].as<std::string>());
+        auto& out = file.is_open() ? static_cast<std::ostream&>(file) : std::cout;
+        out << report.dump(2) << std::endl;
+    }
+};
+
+DECL_APPLICATION(LoggerBenchmark)